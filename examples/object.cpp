@@ -143,4 +143,11 @@ int main() {
 	//Dump the tree
 	tree->dump("object");	
 	delete tree;
+	//Store each tetrahedron once in loose mode
+	OCTREE* loose_tree = new OCTREE( OCTREE::box_type( -1, 1, -1, 1, -1, 1), 4, 2. );
+	for ( auto object : objects ) loose_tree->insert(object);
+	loose_tree->optimize();
+	std::cout << *loose_tree << std::endl;	
+	check(loose_tree, objects);
+	delete loose_tree;
 }
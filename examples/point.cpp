@@ -3,8 +3,12 @@
 #include <array>
 #include <limits>
 #include <thread>
+#include <cmath>
+#include <set>
 
 #include "octree.hpp"
+#include "sharded.hpp"
+#include "nbody.hpp"
 
 const double double_max = std::numeric_limits<double>::max();
 
@@ -37,6 +41,15 @@ bool WRAPPER_CLASS::operator () (box_const_type& box) const {
   return flag;
 }
 
+//Unit masses at the points for Barnes-Hut evaluation
+struct POSITION {
+	std::array<double, 3> operator () (const WRAPPER_CLASS& data) const { return {{ data.object->x, data.object->y, data.object->z }}; }
+};
+struct MASS {
+	double operator () (const WRAPPER_CLASS&) const { return 1.; }
+};
+typedef OCTree::OCTree<3, WRAPPER_CLASS, OCTree::mutex_sync_object, OCTree::monopole_aggregate<3, double, POSITION, MASS> > NBODY_OCTREE;
+
 void fill (OCTREE* tree, const std::vector<WRAPPER_CLASS>& objects, const int& thread_num) {
 	for ( auto object : objects ) tree->insert(object);
 	return;
@@ -47,6 +60,11 @@ void optimize(OCTREE* tree) {
 	return;
 }
 
+//Exact test of count_in
+bool inside(const WRAPPER_CLASS& data) {
+	return std::fabs(data.object->x) <= 0.5 && std::fabs(data.object->y) <= 0.5 && std::fabs(data.object->z) <= 0.5;
+}
+
 struct functor {
 	bool operator( )( const NODE& node ) const {
 		auto box  = node._M_box;
@@ -60,7 +78,7 @@ struct functor {
 	}	
 };
 
-void check(OCTREE* tree, const std::vector<WRAPPER_CLASS>& objects) {
+void check(OCTREE* tree, const std::vector<WRAPPER_CLASS>& objects, const size_t& inserts) {
 	
 	OCTREE::query_type query_point = {{ 0.0, 0.0, 0.0}};
 	
@@ -68,6 +86,31 @@ void check(OCTREE* tree, const std::vector<WRAPPER_CLASS>& objects) {
 	std::vector<WRAPPER_CLASS> find_nearest   = tree->find_nearest  (query_point);
 	std::vector<WRAPPER_CLASS> find_nearest_s = tree->find_nearest_s(query_point);
 	std::vector<WRAPPER_CLASS> find_if        = tree->find_if       (  functor());
+	size_t                     count_if       = tree->count_if      (  functor());
+	size_t                     count_in       = tree->count_in      (  OCTREE::box_type( -0.5, 0.5, -0.5, 0.5, -0.5, 0.5), inside );
+	//Points on bounds of leaf nodes are stored in each of them, counts take every object once
+	//Each point is inserted once by every filling thread
+	std::set<POINT*> found;
+	for ( auto object : find_if ) found.insert(object.object);
+	size_t inside_count = 0;
+	for ( auto object : objects ) inside_count += inside(object) ? 1 : 0;
+	if ( count_if != inserts * found.size() || count_in != inserts * inside_count ) 
+		std::cout << "wrong counts: " << count_if << " of " << inserts * found.size() << ", " << count_in << " of " << inserts * inside_count << std::endl;
+	//Squared distance between an object and a query point
+	auto distance = [] (const WRAPPER_CLASS& object, OCTREE::query_const_type& point) {
+		const double dx = object.object->x - point[0];
+		const double dy = object.object->y - point[1];
+		const double dz = object.object->z - point[2];
+		return dx*dx + dy*dy + dz*dz;
+	};
+	auto find_nearest_object = tree->find_nearest_object(query_point, distance);
+	auto find_within         = tree->find_within        (query_point, 0.5, distance);
+	//Coherent queries start from the leaf node of the previous one
+	OCTREE::cursor_type cursor;
+	for ( auto object : objects ) {
+		OCTREE::query_type point = {{ object.object->x, object.object->y, object.object->z }};
+		std::vector<WRAPPER_CLASS> find_exact_hint = tree->find_exact(point, cursor);
+	}
 
 	return;
 }
@@ -112,13 +155,63 @@ int main() {
 	std::cout << *tree << std::endl;	
 	//Check the tree in multithreaded mode
 	for (size_t i = 0; i < num_threads; ++i)
-		threads.push_back(std::thread(&check   , tree, objects));
+		threads.push_back(std::thread(&check   , tree, objects, num_threads));
 	for (size_t i = 0; i < num_threads; ++i)
 		threads[i].join();
 	threads.clear();
 	//Dump the tree
 	tree->dump("point");	
-	
+	//Move the points towards the origin and back in place, relocate_all keeps every insert of a point
+	for ( double scale : { 0.5, 2. } ) {
+		for ( auto object : objects ) {
+			object.object->x *= scale; object.object->y *= scale; object.object->z *= scale;
+		}
+		tree->relocate_all();
+		const size_t relocated = tree->count_if( OCTree::_TrueFunctor() );
+		std::cout << "relocated count_if          : " << relocated << " of " << num_threads * objects.size() << std::endl;
+	}
+	for (size_t i = 0; i < num_threads; ++i)
+		threads.push_back(std::thread(&check   , tree, objects, num_threads));
+	for (size_t i = 0; i < num_threads; ++i)
+		threads[i].join();
+	threads.clear();
+	//Sharded tree: each worker thread owns a part of the box, filling threads only route objects to the owners
+	typedef OCTree::ShardedOCTree<3, WRAPPER_CLASS, OCTree::mutex_sync_object> SHARDED_OCTREE;
+	SHARDED_OCTREE* sharded = new SHARDED_OCTREE( OCTREE::box_type( -1, 1, -1, 1, -1, 1), num_threads );
+	for (size_t i = 0; i < num_threads; ++i)
+		threads.push_back(std::thread( [sharded, &objects] () { for ( auto object : objects ) sharded->insert(object); } ));
+	for (size_t i = 0; i < num_threads; ++i)
+		threads[i].join();
+	threads.clear();
+	sharded->optimize();
+	std::vector<WRAPPER_CLASS> sharded_find_if  = sharded->find_if (functor());
+	size_t                     sharded_count_in = sharded->count_in( OCTREE::box_type( -0.5, 0.5, -0.5, 0.5, -0.5, 0.5), inside );
+	//Objects on bounds of cells are found once and counted by the first shard of them, as the tree counts them
+	size_t inside_count = 0;
+	for ( auto object : objects ) inside_count += inside(object) ? 1 : 0;
+	std::cout << "sharded find_if / count_in  : " << sharded_find_if.size() << " " << sharded_count_in << " of " << num_threads * inside_count << std::endl;
+	delete sharded;
+	//Barnes-Hut evaluation: points of the grid lie on bounds of nodes, so most of them are stored in several leaf nodes
+	//With theta = 0 every branch is opened, so the result must match the direct sum
+	NBODY_OCTREE* nbody = new NBODY_OCTREE( OCTREE::box_type( -1, 1, -1, 1, -1, 1) );
+	std::vector<NBODY_OCTREE::query_type> targets;
+	for ( auto object : objects ) {
+		nbody->insert(object);
+		targets.push_back( POSITION()(object) );
+	}
+	nbody->optimize();
+	const OCTree::gravity_kernel<3, double> kernel(1., 0.1);
+	std::vector< std::array<double, 3> > tree_force = nbody->evaluate(targets, 0., kernel);
+	double max_error = 0;
+	for ( size_t i = 0; i < targets.size(); ++i ) {
+		std::array<double, 3> direct = {{ 0., 0., 0. }};
+		for ( auto object : objects ) kernel( direct, targets[i], POSITION()(object), MASS()(object) );
+		for ( size_t dim = 0; dim < 3; dim++ ) max_error = std::max( max_error, std::fabs(tree_force[i][dim] - direct[dim]) );
+	}
+	std::cout << "total mass                  : " << nbody->aggregate().mass() << " of " << objects.size() << std::endl;
+	std::cout << "Barnes-Hut error (theta = 0): " << max_error << std::endl;
+	delete nbody;
+
 	delete tree;
 	for (auto object : objects) delete object.object;
 }
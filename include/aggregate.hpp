@@ -0,0 +1,48 @@
+#ifndef INCLUDE_OCTTREE_AGGREGATE_HPP
+#define INCLUDE_OCTTREE_AGGREGATE_HPP
+
+#include <algorithm>
+#include <limits>
+
+namespace OCTree {
+	//Aggregate policies summarize objects of a branch by a monoid
+	//from_object maps an object to a value, combine is associative and commutative, identity is its neutral element
+	//An object stored in several leaf nodes contributes once, to the branches of the first of them in the depth-first order
+	
+	//Default policy, nodes do not keep any summary
+	struct empty_aggregate {
+		struct value_type {};
+		template <typename __Object>
+		static value_type from_object(const __Object&)                   { return value_type(); }
+		static value_type combine    (const value_type&, const value_type&) { return value_type(); }
+		static value_type identity   ()                                   { return value_type(); }
+	};
+	//Sum of an attribute of objects, __Attribute maps an object to the attribute
+	template <typename __Type, class __Attribute>
+	struct sum_aggregate {
+		typedef __Type value_type;
+		template <typename __Object>
+		static value_type from_object(const __Object& object)                { return __Attribute()(object); }
+		static value_type combine    (const value_type& a, const value_type& b) { return a + b;                }
+		static value_type identity   ()                                      { return value_type();           }
+	};
+	//Maximum of an attribute of objects
+	template <typename __Type, class __Attribute>
+	struct max_aggregate {
+		typedef __Type value_type;
+		template <typename __Object>
+		static value_type from_object(const __Object& object)                { return __Attribute()(object);                    }
+		static value_type combine    (const value_type& a, const value_type& b) { return std::max(a, b);                          }
+		static value_type identity   ()                                      { return std::numeric_limits<value_type>::lowest(); }
+	};
+	//Minimum of an attribute of objects
+	template <typename __Type, class __Attribute>
+	struct min_aggregate {
+		typedef __Type value_type;
+		template <typename __Object>
+		static value_type from_object(const __Object& object)                { return __Attribute()(object);                 }
+		static value_type combine    (const value_type& a, const value_type& b) { return std::min(a, b);                       }
+		static value_type identity   ()                                      { return std::numeric_limits<value_type>::max(); }
+	};
+}
+#endif //INCLUDE_OCTTREE_AGGREGATE_HPP
@@ -7,160 +7,158 @@ namespace OCTree {
 	template <size_t const __K, typename _Val>  
 	using _QueryPoint = std::array<_Val, __K>;
 
+	//Type of squared distances between points with coordinates of type _Val
+	//Floating point coordinates keep their own type, integer (quantized) coordinates use double,
+	//so squares of large differences neither overflow nor get truncated
+	template <typename _Val, bool = std::is_integral<_Val>::value>
+	struct _distance_traits {
+		typedef _Val   distance_type;
+	};
+	template <typename _Val>
+	struct _distance_traits<_Val, true> {
+		typedef double distance_type;
+	};
+	template <typename _Val>
+	using _Distance = typename _distance_traits<_Val>::distance_type;
+
+	//Loops over dimensions unrolled at compile time, the index of a term is a constant after inlining
+	//sum() adds terms from the first dimension to the last one, as a plain loop does
+	template <size_t const __I, size_t const __K>
+	struct _Dims {
+		template <typename _Val, class _Term>
+		static _Val sum(_Val acc, const _Term& term) { return _Dims<__I + 1, __K>::sum(acc + term(__I), term); }
+		template <class _Test>
+		static bool all(const _Test& test)          { return test(__I) && _Dims<__I + 1, __K>::all(test); }
+	};
+	template <size_t const __K>
+	struct _Dims<__K, __K> {
+		template <typename _Val, class _Term>
+		static _Val sum(_Val acc, const _Term&)      { return acc; }
+		template <class _Test>
+		static bool all(const _Test&)               { return true; }
+	};
+
 	//Service static functions
 	template <size_t const __K, typename _Val>
-	static _Val _shortest_distance(_Box<__K, _Val> const& _box, _QueryPoint<__K, _Val> const& _point) {
-		_Val distance = 0;
-		for (size_t __i = 0; __i != __K; ++__i) {
+	static _Distance<_Val> _shortest_distance(_Box<__K, _Val> const& _box, _QueryPoint<__K, _Val> const& _point) {
+		typedef _Distance<_Val> distance_type;
+		return _Dims<0, __K>::sum( distance_type(0), [&] (size_t __i) -> distance_type {
 			if (
 				(_point[__i] < _box._M_low_bounds[__i]) || (_point[__i] > _box._M_high_bounds[__i])
 				) {
-				_Val temp = std::min(std::abs(_point[__i] - _box._M_low_bounds[__i]), std::abs(_point[__i] - _box._M_high_bounds[__i]));
-				distance += temp*temp;
+				distance_type temp = std::min(
+					std::abs(distance_type(_point[__i]) - _box._M_low_bounds[__i]), 
+					std::abs(distance_type(_point[__i]) - _box._M_high_bounds[__i])
+				);
+				return temp*temp;
 			}
-		}
-		return distance;
+			return 0;
+		} );
 	}
 	template <size_t const __K, typename _Val>
-	static _Val _longest_distance(_Box<__K, _Val> const& _box, _QueryPoint<__K, _Val> const& _point) {
-		_Val distance = 0;
-		for (size_t __i = 0; __i != __K; ++__i) {
-			_Val temp = std::max(std::abs(_point[__i] - _box._M_low_bounds[__i]), std::abs(_point[__i] - _box._M_high_bounds[__i]));
-			distance += temp*temp;
-		}
-		return distance;
+	static _Distance<_Val> _shortest_distance(_Box<__K, _Val> const& _left, _Box<__K, _Val> const& _right) {
+		typedef _Distance<_Val> distance_type;
+		return _Dims<0, __K>::sum( distance_type(0), [&] (size_t __i) -> distance_type {
+			distance_type temp = std::max(
+				distance_type(_right._M_low_bounds[__i]) - _left._M_high_bounds[__i], 
+				distance_type(_left._M_low_bounds[__i])  - _right._M_high_bounds[__i]
+			);
+			return temp > 0 ? temp*temp : 0;
+		} );
+	}
+	template <size_t const __K, typename _Val>
+	static _Distance<_Val> _longest_distance(_Box<__K, _Val> const& _box, _QueryPoint<__K, _Val> const& _point) {
+		typedef _Distance<_Val> distance_type;
+		return _Dims<0, __K>::sum( distance_type(0), [&] (size_t __i) -> distance_type {
+			distance_type temp = std::max(
+				std::abs(distance_type(_point[__i]) - _box._M_low_bounds[__i]), 
+				std::abs(distance_type(_point[__i]) - _box._M_high_bounds[__i])
+			);
+			return temp*temp;
+		} );
 	}
 	template <size_t const __K, typename _Val>
 	static bool _intersects_with(_Box<__K, _Val> const& _box, _Sphere<__K, _Val> const& _sphere) {
-		_Val radius2 = _shortest_distance(_box, _sphere._M_center);
+		_Distance<_Val> radius2 = _shortest_distance(_box, _sphere._M_center);
 		return radius2 <= _sphere._M_radius2;
 	}
 	template <size_t const __K, typename _Val>
 	static bool _intersects_with(_Box<__K, _Val> const& _left, _Box<__K, _Val> const& _right) {
-		for (size_t __i = 0; __i != __K; ++__i) {
-			if (
+		return _Dims<0, __K>::all( [&] (size_t __i) {
+			return !(
 				(_right._M_high_bounds[__i] < _left._M_low_bounds[__i]) || (_right._M_low_bounds[__i] > _left._M_high_bounds[__i])
-				) return false;
-		}
-		return true;
+				);
+		} );
 	}
 	template <size_t const __K, typename _Val>
 	static bool _is_inside(_Sphere<__K, _Val> const& _sphere, _QueryPoint<__K, _Val> const& point) {
-		_Val distance2 = 0;
-		for (size_t __i = 0; __i != __K; ++__i) {
-			_Val temp = point[__i] - _sphere._M_center[__i];
-			distance2 += temp*temp;
-		}
+		typedef _Distance<_Val> distance_type;
+		distance_type distance2 = _Dims<0, __K>::sum( distance_type(0), [&] (size_t __i) -> distance_type {
+			distance_type temp = distance_type(point[__i]) - _sphere._M_center[__i];
+			return temp*temp;
+		} );
 		return distance2 <= _sphere._M_radius2;
 	}
 	template <size_t const __K, typename _Val>
+	static bool _contains(_Sphere<__K, _Val> const& _sphere, _Box<__K, _Val> const& _box) {
+		_Distance<_Val> radius2 = _longest_distance(_box, _sphere._M_center);
+		return radius2 <= _sphere._M_radius2;
+	}
+	template <size_t const __K, typename _Val>
+	static bool _contains(_Box<__K, _Val> const& _outer, _Box<__K, _Val> const& _inner) {
+		return _Dims<0, __K>::all( [&] (size_t __i) {
+			return !(
+				(_inner._M_low_bounds[__i] < _outer._M_low_bounds[__i]) || (_inner._M_high_bounds[__i] > _outer._M_high_bounds[__i])
+				);
+		} );
+	}
+	template <size_t const __K, typename _Val>
 	static bool _is_inside(_Box<__K, _Val> const& _box, _QueryPoint<__K, _Val> const& _point) {
-		for (size_t __i = 0; __i != __K; ++__i) {
-			if (
+		return _Dims<0, __K>::all( [&] (size_t __i) {
+			return !(
 				(_point[__i] < _box._M_low_bounds[__i]) || (_point[__i] > _box._M_high_bounds[__i])
-			) return false;
-		}
-		return true;
+				);
+		} );
 	}
 	//////////////////////////////////////////////////////////////////////////////
 	template <size_t const __K, typename _Val>
 	struct _Sphere {
 		typedef       _Val                               value_type;
 		typedef const _Val                         value_const_type;
-		
-		_Sphere() : _M_center(), _M_radius2() {
-			_M_radius2 = std::numeric_limits<value_type>::max();
-			for (size_t __i = 0; __i != __K; ++__i)
-				_M_center[__i] = 0.0;
-		}
-		bool intersects_with(_Box<__K, _Val> const& _box) const {
-			return intersects_with(*this, _box);
-		}
-		bool is_inside(_QueryPoint<__K, _Val> const& _point) const {
-			return is_inside(*this, _point);
-		}
-		_QueryPoint<__K, _Val>  _M_center;
-		value_type              _M_radius2;
-	};
-	template <>
-	struct _Sphere<3, double> {
+		typedef       _Distance<_Val>                 distance_type;
 		//Constructors
 		_Sphere() : _M_center(), _M_radius2() {
-			_M_radius2 = std::numeric_limits<double>::max();
-			_M_center[0] = 0.0; _M_center[1] = 0.0; _M_center[2] = 0.0;
+			_M_radius2 = std::numeric_limits<distance_type>::max();
+			for (size_t __i = 0; __i != __K; ++__i)
+				_M_center[__i] = 0;
 		}
-		_Sphere(
-			const double x_center, 
-			const double y_center, 
-			const double z_center,
-			const double radius2
-		) : _M_center(), _M_radius2(radius2) {
-			_M_center[0] = x_center; _M_center[1] = y_center; _M_center[2] = z_center;
+		//Coordinates of the center followed by the squared radius, e.g. _Sphere<3, double>(x, y, z, radius2)
+		template <typename... _Rest>
+		_Sphere(const value_type first, const _Rest... rest) : _M_center(), _M_radius2() {
+			static_assert(sizeof...(_Rest) == __K, "_Sphere expects K coordinates of the center and the squared radius");
+			const distance_type values[] = { distance_type(first), static_cast<distance_type>(rest)... };
+			for (size_t __i = 0; __i != __K; ++__i)
+				_M_center[__i] = static_cast<value_type>(values[__i]);
+			_M_radius2 = values[__K];
 		}
 		_Sphere(
-			const _QueryPoint<3, double> center,
-			const double radius2
+			const _QueryPoint<__K, _Val> center,
+			const distance_type radius2
 			) : _M_center(center), _M_radius2(radius2) {
 		}
 		//Methods
-		bool intersects_with(       _Box<3, double> const&   _box) const { return _intersects_with( _box, *this); }
-		bool is_inside      (_QueryPoint<3, double> const& _point) const { return _is_inside      (*this, _point);}
-		_QueryPoint<3, double>    _M_center;
-		double					  _M_radius2;
-	};
-	template <>
-	struct _Sphere<2, double> {
-		//Constructors
-		_Sphere() : _M_center(), _M_radius2() {
-			_M_radius2 = std::numeric_limits<double>::max();
-			_M_center[0] = 0.0; _M_center[1] = 0.0;
-		}
-		_Sphere(
-			const double x_center,
-			const double y_center,
-			const double radius2
-			) : _M_center(), _M_radius2(radius2) {
-			_M_center[0] = x_center;
-			_M_center[1] = y_center;
-		}
-		_Sphere(
-			const _QueryPoint<2, double> center,
-			const double radius2
-			) : _M_center(center), _M_radius2(radius2) { }
-		//Methods
-		bool intersects_with(         _Box<2, double> const& _box) const { return _intersects_with( _box,  *this);	}
-		bool is_inside      (_QueryPoint<2, double> const& _point) const { return _is_inside      (*this, _point);  }
-		_QueryPoint<2, double>    _M_center;
-		double					  _M_radius2;
-	};
-	template <>
-	struct _Sphere<1, double> {
-		//Constructors
-		_Sphere() : _M_center(), _M_radius2() {
-			_M_radius2 = std::numeric_limits<double>::max();
-			_M_center[0] = 0.0;
-		}
-		_Sphere(
-			const double x_center,
-			const double radius2
-			) : _M_center(), _M_radius2(radius2) {
-			_M_center[0] = x_center;
-		}
-		_Sphere(
-			const _QueryPoint<1, double> center,
-			const double radius2
-			) : _M_center(center), _M_radius2(radius2) { }
-		//Methods
-		bool intersects_with(       _Box<1, double> const&   _box) const { return _intersects_with(  _box, *this); }
-		bool is_inside      (_QueryPoint<1, double> const& _point) const { return _is_inside      (*this, _point); }
-		_QueryPoint<1, double>    _M_center;
-		double					  _M_radius2;
+		bool intersects_with(       _Box<__K, _Val> const&   _box) const { return _intersects_with( _box, *this); }
+		bool contains       (       _Box<__K, _Val> const&   _box) const { return _contains       (*this,  _box); }
+		bool is_inside      (_QueryPoint<__K, _Val> const& _point) const { return _is_inside      (*this, _point);}
+		_QueryPoint<__K, _Val>  _M_center;
+		distance_type           _M_radius2;
 	};
 	/////////////////////////////////////////////////////////////////////
 	template <size_t const __K, typename _Val>
 	struct _Box {
 		typedef       _Val                               value_type;
 		typedef const _Val                         value_const_type;
+		typedef       _Distance<_Val>                 distance_type;
 		//Constructors
 		_Box() {
 			value_type _max = std::numeric_limits<value_type>::max();
@@ -169,6 +167,16 @@ namespace OCTree {
 				_M_high_bounds[__i] = -_max;
 			}
 		}
+		//Bounds of every dimension in turn, e.g. _Box<3, double>(x_min, x_max, y_min, y_max, z_min, z_max)
+		template <typename... _Rest>
+		_Box(const value_type low, const value_type high, const _Rest... rest) {
+			static_assert(sizeof...(_Rest) + 2 == 2*__K, "_Box expects the low and the high bound of every dimension");
+			const value_type values[] = { low, high, static_cast<value_type>(rest)... };
+			for (size_t __i = 0; __i != __K; ++__i) {
+				_M_low_bounds [__i] = values[2*__i];
+				_M_high_bounds[__i] = values[2*__i + 1];
+			}
+		}
 		//Methods
 		//Checks intersection of regions
 		bool intersects_with(_Sphere<__K, _Val> const& _sphere) const {
@@ -176,15 +184,23 @@ namespace OCTree {
 		}
 		//Checks intersection of regions
 		bool intersects_with(_Box const& _box) const {
-			return intersects_with( *this, _box);
+			return _intersects_with( *this, _box);
+		}
+		//Checks that the region contains a box
+		bool contains(_Box const& _box) const {
+			return _contains( *this, _box);
 		}
 		//Calculates the shortest distance between the query point and the region
-		value_type shortest_distance(_QueryPoint<__K, _Val> const& _point) const {
+		distance_type shortest_distance(_QueryPoint<__K, _Val> const& _point) const {
 			return _shortest_distance(*this, _point);
 		}
+		//Calculates the shortest distance between regions
+		distance_type shortest_distance(_Box const& _box) const {
+			return _shortest_distance(*this, _box);
+		}
 		//Calculates the longest distance between the query point and the region
 		//If the query point within the region it will return 0
-		value_type longest_distance(_QueryPoint<__K, _Val> const& _point) const {
+		distance_type longest_distance(_QueryPoint<__K, _Val> const& _point) const {
 			return _longest_distance(*this, _point);
 		}
 		//Checks that the query point within the region
@@ -193,100 +209,6 @@ namespace OCTree {
 		}
 		value_type _M_low_bounds[__K], _M_high_bounds[__K];
 	};
-	//Full specialization of the class is required to add new constructors
-	template <>
-	struct _Box<3, double> {
-		typedef       double                               value_type;
-		typedef const double                         value_const_type;
-		//Constructors
-		_Box() {
-			value_type value_type_max = std::numeric_limits<value_type>::max();
-			_M_low_bounds [0] = value_type_max;
-			_M_low_bounds [1] = value_type_max;
-			_M_low_bounds [2] = value_type_max;
-			_M_high_bounds[0] = -value_type_max;
-			_M_high_bounds[1] = -value_type_max;
-			_M_high_bounds[2] = -value_type_max;
-		}
-		_Box( 
-			const double x_min, 
-			const double x_max,
-			const double y_min,
-			const double y_max,
-			const double z_min,
-			const double z_max
-			) { 
-			_M_low_bounds[0]  = x_min;
-			_M_low_bounds[1]  = y_min;
-			_M_low_bounds[2]  = z_min;
-			_M_high_bounds[0] = x_max;
-			_M_high_bounds[1] = y_max;
-			_M_high_bounds[2] = z_max;
-		}
-		//Methods
-		bool       intersects_with  (    _Sphere<3, double> const& _sphere) const { return _intersects_with(*this, _sphere); }
-		bool       intersects_with  (       _Box<3, double> const&    _box) const { return _intersects_with(_box, *this); }
-		value_type shortest_distance(_QueryPoint<3, double> const&  _point) const { return _shortest_distance(*this, _point); }
-		value_type longest_distance (_QueryPoint<3, double> const&  _point) const { return _longest_distance(*this, _point); }
-		bool       is_inside        (_QueryPoint<3, double> const&  _point) const { return _is_inside(*this, _point); }
-		value_type _M_low_bounds[3], _M_high_bounds[3];
-	};
-	template <>
-	struct _Box<2, double> {
-		typedef       double                               value_type;
-		typedef const double                         value_const_type;
-		//Constructors
-		_Box() {
-			value_type value_type_max = std::numeric_limits<value_type>::max();
-			_M_low_bounds [0] = value_type_max;
-			_M_low_bounds [1] = value_type_max;
-			_M_high_bounds[0] = -value_type_max;
-			_M_high_bounds[1] = -value_type_max;
-		}
-		_Box(
-			const double x_min,
-			const double x_max,
-			const double y_min,
-			const double y_max
-			) {
-			_M_low_bounds[0] = x_min;
-			_M_low_bounds[1] = y_min;
-			_M_high_bounds[0] = x_max;
-			_M_high_bounds[1] = y_max;
-		}
-		//Methods
-		bool       intersects_with  (    _Sphere<2, double> const& _sphere) const { return _intersects_with(*this, _sphere); }
-		bool       intersects_with  (       _Box<2, double> const&    _box) const { return _intersects_with( _box,   *this); }
-		value_type shortest_distance(_QueryPoint<2, double> const&  _point) const { return _shortest_distance(*this,_point); }
-		value_type longest_distance (_QueryPoint<2, double> const&  _point) const {	return _longest_distance(*this, _point); }
-		bool       is_inside        (_QueryPoint<2, double> const&  _point) const {	return _is_inside(*this, _point); }
-		value_type _M_low_bounds[2], _M_high_bounds[2];
-	};
-	template <>
-	struct _Box<1, double> {
-		typedef       double                               value_type;
-		typedef const double                         value_const_type;
-		//Constructors
-		_Box() {
-			value_type value_type_max = std::numeric_limits<value_type>::max();
-			_M_low_bounds[0] = value_type_max;
-			_M_high_bounds[0] = -value_type_max;
-		}
-		_Box(
-			const double x_min,
-			const double x_max
-			) {
-			_M_low_bounds[0] = x_min;
-			_M_high_bounds[0] = x_max;
-		}
-		//Methods
-		bool       intersects_with  (    _Sphere<1, double> const& _sphere) const { return _intersects_with(*this, _sphere); }
-		bool       intersects_with  (       _Box<1, double> const&    _box) const { return _intersects_with(_box, *this); }
-		value_type shortest_distance(_QueryPoint<1, double> const&  _point) const { return _shortest_distance(*this, _point); }
-		value_type longest_distance (_QueryPoint<1, double> const&  _point) const { return _longest_distance(*this, _point); }
-		bool       is_inside        (_QueryPoint<1, double> const&  _point) const { return _is_inside(*this, _point); }
-		value_type _M_low_bounds[1], _M_high_bounds[1];
-	};
 
 	typedef _Box   <3, double> _Box3D;
     typedef _Box   <2, double> _Box2D;
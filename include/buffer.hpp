@@ -0,0 +1,218 @@
+#ifndef INCLUDE_OCTTREE_BUFFER_HPP
+#define INCLUDE_OCTTREE_BUFFER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace OCTree {
+	//Storage of objects of a node: a flat array and chunked append-only segments
+	//push_back is lock-free: a writer reserves a slot by an atomic bump index, constructs the object in place and
+	//marks the slot ready; the published prefix grows over consecutive ready slots, so readers never see a slot
+	//which is being written and segments are never moved
+	//Segments grow geometrically (__Base, 2*__Base, ...) and are allocated on first use, as well as their directory
+	//compact(), sort(), swap() and clear() move segments into the flat array and must not run concurrently with
+	//other members
+	template <class __Item, size_t __Base = 16>
+	class append_vector {
+	private:
+		//Objects of a segment are contiguous, ready flags are kept apart from them
+		struct segment {
+			segment(size_t capacity_) : capacity(capacity_), ready(new std::atomic<bool>[capacity_]), items(static_cast<__Item*>(::operator new(capacity_*sizeof(__Item)))) {
+				for (size_t i = 0; i < capacity; ++i) ready[i].store(false, std::memory_order_relaxed);
+			}
+			~segment() {
+				for (size_t i = 0; i < capacity; ++i)
+					if (ready[i].load()) items[i].~__Item();
+				delete[] ready;
+				::operator delete(items);
+			}
+			const size_t                            capacity;
+			std::atomic<bool>*                      ready;
+			__Item*                                 items;
+		private:
+			segment(const segment&);
+		};
+		static const size_t segment_count = 48;
+		struct directory {
+			directory() { for (size_t i = 0; i < segment_count; ++i) segments[i].store(nullptr); }
+			std::atomic<segment*>                   segments[segment_count];
+		};
+		std::vector<__Item>                         flat;
+		std::atomic<size_t>                         reserved;
+		std::atomic<size_t>                         published;
+		std::atomic<directory*>                     dir;
+	public:
+		//Forward iterator which walks contiguous runs of objects (the flat array, then segments) by a pointer
+		class const_iterator : public std::iterator<std::forward_iterator_tag, __Item, std::ptrdiff_t, const __Item*, const __Item&> {
+		public:
+			const_iterator() : owner(nullptr), index(0), current(nullptr), limit(nullptr) {}
+			const_iterator(const append_vector* owner_, size_t index_) : owner(owner_), index(index_), current(nullptr), limit(nullptr) {}
+			const __Item&   operator* () const { if (current == limit) seek(); return *current; }
+			const __Item*   operator->() const { if (current == limit) seek(); return  current; }
+			const_iterator& operator++()       { ++index; if (current != limit) ++current; return *this; }
+			const_iterator  operator++(int)    { const_iterator result = *this; ++(*this); return result; }
+			bool operator==(const const_iterator& other) const { return index == other.index; }
+			bool operator!=(const const_iterator& other) const { return index != other.index; }
+		private:
+			//Finds the run which keeps the object of the index
+			void seek() const {
+				if (index < owner->flat.size()) {
+					current = owner->flat.data() + index;
+					limit   = owner->flat.data() + owner->flat.size();
+					return;
+				}
+				size_t segment_, offset;
+				locate(index - owner->flat.size(), segment_, offset);
+				const segment* s = owner->dir.load(std::memory_order_acquire)->segments[segment_].load(std::memory_order_acquire);
+				current = s->items + offset;
+				limit   = s->items + s->capacity;
+			}
+			const append_vector*                     owner;
+			size_t                                   index;
+			mutable const __Item*                    current;
+			mutable const __Item*                    limit;
+		};
+		typedef const_iterator                                 iterator;
+		typedef __Item                                         value_type;
+
+		append_vector() : flat(), reserved(0), published(0), dir(nullptr) {}
+		//Copies wait for pushes which have reserved their slots before, so a copy has every object whose push_back returned
+		append_vector(const append_vector& other) : flat(), reserved(0), published(0), dir(nullptr) {
+			other.settle();
+			flat.assign(other.begin(), other.end());
+		}
+		append_vector& operator=(const append_vector& other) {
+			if (this == &other) return *this;
+			clear();
+			other.settle();
+			flat.assign(other.begin(), other.end());
+			return *this;
+		}
+		~append_vector() { clear(); }
+
+		void push_back(const __Item& item) {
+			const size_t index = reserved.fetch_add(1, std::memory_order_relaxed);
+			size_t segment_, offset;
+			locate(index, segment_, offset);
+			segment* target = acquire(segment_);
+			new (target->items + offset) __Item(item);
+			target->ready[offset].store(true, std::memory_order_release);
+			publish();
+		}
+		//Objects of the flat array and of the published prefix of segments
+		size_t size () const { return flat.size() + published.load(std::memory_order_acquire); }
+		bool   empty() const { return size() == 0; }
+		size_t capacity() const {
+			size_t result = flat.capacity();
+			directory* d = dir.load(std::memory_order_acquire);
+			if (d != nullptr)
+				for (size_t index = 0; index < segment_count; ++index)
+					if (d->segments[index].load(std::memory_order_acquire) != nullptr) result += __Base << index;
+			return result;
+		}
+		const __Item& operator[](size_t index) const {
+			if (index < flat.size()) return flat[index];
+			size_t segment_, offset;
+			locate(index - flat.size(), segment_, offset);
+			return dir.load(std::memory_order_acquire)->segments[segment_].load(std::memory_order_acquire)->items[offset];
+		}
+		const_iterator begin() const { return const_iterator(this, 0);      }
+		const_iterator end  () const { return const_iterator(this, size()); }
+		//Objects of the flat array, which are all objects after compact()
+		const __Item*  flat_begin() const { return flat.data(); }
+		const __Item*  flat_end  () const { return flat.data() + flat.size(); }
+
+		//Moves objects of segments into the flat array and releases segments
+		void compact() {
+			const size_t count = published.load(std::memory_order_acquire);
+			if (count == 0 && dir.load() == nullptr) return;
+			flat.reserve(flat.size() + count);
+			directory* d = dir.load();
+			for (size_t index = 0; index < count; ++index) {
+				size_t segment_, offset;
+				locate(index, segment_, offset);
+				flat.push_back(std::move(d->segments[segment_].load()->items[offset]));
+			}
+			release();
+		}
+		void sort() {
+			compact();
+			std::sort(flat.begin(), flat.end());
+		}
+		void swap(std::vector<__Item>& data) {
+			compact();
+			flat.swap(data);
+		}
+		void clear() {
+			release();
+			flat.clear();
+		}
+	private:
+		//Segment of an index and the offset in it, segment s keeps indices [__Base*(2^s - 1), __Base*(2^(s+1) - 1))
+		static void locate(size_t index, size_t& segment, size_t& offset) {
+			const size_t n = index/__Base + 1;
+#ifdef __GNUC__
+			segment = sizeof(unsigned long long)*8 - 1 - __builtin_clzll(n);
+#else
+			segment = 0;
+			while ((n >> (segment + 1)) != 0) ++segment;
+#endif
+			offset = index - __Base*((size_t(1) << segment) - 1);
+		}
+		//Allocates the directory and a segment on first use, a writer which loses the race frees its allocation
+		segment* acquire(size_t index) {
+			directory* d = dir.load(std::memory_order_acquire);
+			if (d == nullptr) {
+				directory* created = new directory();
+				if (dir.compare_exchange_strong(d, created, std::memory_order_acq_rel)) d = created;
+				else delete created;
+			}
+			segment* s = d->segments[index].load(std::memory_order_acquire);
+			if (s == nullptr) {
+				segment* created = new segment(__Base << index);
+				if (d->segments[index].compare_exchange_strong(s, created, std::memory_order_acq_rel)) s = created;
+				else delete created;
+			}
+			return s;
+		}
+		//Advances the published prefix over ready slots, each writer helps after marking its own slot
+		void publish() {
+			size_t count = published.load(std::memory_order_acquire);
+			while (count < reserved.load(std::memory_order_acquire)) {
+				size_t segment_, offset;
+				locate(count, segment_, offset);
+				directory* d = dir.load(std::memory_order_acquire);
+				segment*   s = d != nullptr ? d->segments[segment_].load(std::memory_order_acquire) : nullptr;
+				if (s == nullptr || !s->ready[offset].load(std::memory_order_acquire)) return;
+				if (published.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel)) ++count;
+			}
+		}
+		//Waits until slots reserved before the call are published, helping writers which have marked theirs
+		//A writer may return while an earlier slot is still being written, so its object is published by a later one
+		void settle() const {
+			const size_t target = reserved.load(std::memory_order_acquire);
+			while (published.load(std::memory_order_acquire) < target) {
+				const_cast<append_vector*>(this)->publish();
+				std::this_thread::yield();
+			}
+		}
+		//Destroys objects of segments and frees segments and the directory
+		void release() {
+			directory* d = dir.exchange(nullptr);
+			if (d != nullptr) {
+				for (size_t index = 0; index < segment_count; ++index)
+					delete d->segments[index].load();
+				delete d;
+			}
+			reserved  = 0;
+			published = 0;
+		}
+	};
+}
+#endif //INCLUDE_OCTTREE_BUFFER_HPP
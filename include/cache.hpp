@@ -0,0 +1,85 @@
+#ifndef INCLUDE_OCTTREE_CACHE_HPP
+#define INCLUDE_OCTTREE_CACHE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace OCTree {
+	//Hash of a sequence of values, keys of cached queries are their kinds and parameters
+	template <class __Item>
+	struct sequence_hash {
+		size_t operator()(const std::vector<__Item>& items) const {
+			size_t result = items.size();
+			for (auto it = items.begin(); it != items.end(); ++it)
+				result ^= std::hash<__Item>()(*it) + 0x9e3779b9 + (result << 6) + (result >> 2);
+			return result;
+		}
+	};
+
+	//Bounded map of query results, the least recently used entry is dropped first
+	//An entry is returned only if valid(value) is true for it, a stale entry is dropped and counted as a miss
+	//Members lock a mutex, so queries of several threads share the cache
+	template <class __Key, class __Value, class __Hash = std::hash<__Key> >
+	class result_cache {
+	private:
+		typedef std::pair<__Key, __Value>                                              entry_type;
+		typedef typename std::list<entry_type>::iterator                               entry_iterator;
+		std::list<entry_type>                                  entries;
+		std::unordered_map<__Key, entry_iterator, __Hash>      index;
+		size_t                                                 capacity;
+		std::mutex                                             sync;
+		std::atomic<size_t>                                    hit_count;
+		std::atomic<size_t>                                    miss_count;
+	private:
+		result_cache(const result_cache&);
+	public:
+		result_cache(size_t capacity_) : entries(), index(), capacity(capacity_), sync(), hit_count(0), miss_count(0) {}
+		template <class __Valid>
+		bool find(const __Key& key, __Value& value, const __Valid& valid) {
+			std::lock_guard<std::mutex> lock(sync);
+			auto it_index = index.find(key);
+			if (it_index != index.end()) {
+				if (valid(it_index->second->second)) {
+					entries.splice(entries.begin(), entries, it_index->second);
+					value = it_index->second->second;
+					++hit_count;
+					return true;
+				}
+				entries.erase(it_index->second);
+				index.erase(it_index);
+			}
+			++miss_count;
+			return false;
+		}
+		void store(const __Key& key, const __Value& value) {
+			std::lock_guard<std::mutex> lock(sync);
+			if (capacity == 0) return;
+			auto it_index = index.find(key);
+			if (it_index != index.end()) {
+				entries.erase(it_index->second);
+				index.erase(it_index);
+			}
+			entries.push_front(entry_type(key, value));
+			index[key] = entries.begin();
+			while (entries.size() > capacity) {
+				index.erase(entries.back().first);
+				entries.pop_back();
+			}
+		}
+		void clear() {
+			std::lock_guard<std::mutex> lock(sync);
+			entries.clear();
+			index.clear();
+		}
+		size_t size  () { std::lock_guard<std::mutex> lock(sync); return entries.size(); }
+		size_t hits  () const { return hit_count;  }
+		size_t misses() const { return miss_count; }
+	};
+}
+#endif //INCLUDE_OCTTREE_CACHE_HPP
@@ -6,26 +6,27 @@
 namespace OCTree {
 	template <size_t const __K, typename __Val> 
 	class _SphereFunctor {
-		static const double zero_;
+		static const __Val zero_;
 		
 		template <size_t __L> 
 		using box_const_reference = const _Box<__L, __Val>&;
 		typedef const _Sphere<__K, __Val>& sphere_const_reference;
 		typedef __Val                      value_type;
+		typedef _Distance<__Val>           distance_type;
 		
 		sphere_const_reference _sphere;
 	public:
 		_SphereFunctor(sphere_const_reference sphere ) : _sphere(sphere) {}
 		template <size_t const __L>
 		bool operator() (box_const_reference<__L> box) const {
-			size_t           __i = 0;
-			value_type distance2 = 0;
+			size_t              __i = 0;
+			distance_type distance2 = 0;
 			for (__i = 0; __i != std::min(__K,__L); ++__i) {
 				if ( ( _sphere._M_center[__i] < box._M_low_bounds[__i]) || ( _sphere._M_center[__i] > box._M_high_bounds[__i]) ) {
-					value_type temp = 
+					distance_type temp = 
 						std::min(
-							std::abs( _sphere._M_center[__i] - box._M_low_bounds [__i]),
-							std::abs( _sphere._M_center[__i] - box._M_high_bounds[__i])
+							std::abs( distance_type(_sphere._M_center[__i]) - box._M_low_bounds [__i]),
+							std::abs( distance_type(_sphere._M_center[__i]) - box._M_high_bounds[__i])
 						);
 					distance2 += temp*temp;
 				}
@@ -35,14 +36,14 @@ namespace OCTree {
 			return distance2 <= _sphere._M_radius2;
 		}
 
-		template <size_t _K, typename _Val, class _Sync> 
-		bool operator() ( const _Node<_K, _Val,  _Sync>& node ) const {
-			return true;
+		template <size_t _K, typename _Val, class _Sync, class _Aggregate> 
+		bool operator() ( const _Node<_K, _Val,  _Sync, _Aggregate>& node ) const {
+			return (*this)(node._M_box);
 		}
 	};
 	template <size_t const __K, typename __Val>
 	class _BoxFunctor {
-		static const double zero_;
+		static const __Val zero_;
 
 		template <size_t __L> 
 		using box_const_reference = const _Box<__L, __Val>&;
@@ -67,20 +68,83 @@ namespace OCTree {
 			return true;
 		}
 	
-		template <size_t _K, typename _Val, class _Sync> 
-		bool operator() ( const _Node<_K, _Val, _Sync>& node ) const {
-			return true;
+		template <size_t _K, typename _Val, class _Sync, class _Aggregate> 
+		bool operator() ( const _Node<_K, _Val, _Sync, _Aggregate>& node ) const {
+			return (*this)(node._M_box);
 		}
 	};
 	template <size_t const __K, typename _Val>
-		const double _SphereFunctor<__K, _Val>::zero_ = 0.0;
+		const _Val _SphereFunctor<__K, _Val>::zero_ = 0;
 	template <size_t const __K, typename _Val>
-		const double _BoxFunctor<__K, _Val>::zero_ = 0.0;
+		const _Val _BoxFunctor<__K, _Val>::zero_ = 0;
+	
+	template <size_t const __K, typename __Val>
+	class _PointFunctor {
+		typedef __Val                      value_type;
+		typedef const _Box<__K, __Val>&    box_const_reference;
+		
+		_QueryPoint<__K, __Val> _point;
+	public:
+		_PointFunctor(const _QueryPoint<__K, __Val>& point ) : _point(point) {}
+		bool operator() (box_const_reference box) const {
+			return box.is_inside(_point);
+		}
+		template <typename _Val, class _Sync, class _Aggregate> 
+		bool operator() ( const _Node<__K, _Val, _Sync, _Aggregate>& node ) const {
+			return (*this)(node._M_box);
+		}
+	};
+	
+	//Predicates of pairs of nodes for OCTree::join
+	class _IntersectsFunctor {
+	public:
+		template <class _Left, class _Right> 
+		bool operator()( const _Left& left, const _Right& right ) const { 
+			return _intersects_with(left._M_box, right._M_box); 
+		} 
+	};
+	template <typename __Val>
+	class _DistanceFunctor {
+		typedef _Distance<__Val> distance_type;
+		distance_type _radius2;
+	public:
+		_DistanceFunctor(const distance_type radius) : _radius2(radius*radius) {}
+		template <class _Left, class _Right> 
+		bool operator()( const _Left& left, const _Right& right ) const { 
+			return _shortest_distance(left._M_box, right._M_box) <= _radius2; 
+		} 
+	};
+	
+	//Level-of-detail policies of OCTree::find_nodes_if, descent stops at a node for which policy(node, depth) is true
+	//Stops at nodes of a depth, the root has depth 0
+	class _DepthLOD {
+		size_t _depth;
+	public:
+		_DepthLOD(size_t depth) : _depth(depth) {}
+		template <size_t __K, typename __Val, class __Sync, class __Aggregate> 
+			bool operator()( const _Node<__K, __Val, __Sync, __Aggregate>&, size_t depth ) const { return depth >= _depth; } 
+	};
+	//Stops at nodes whose box is not longer than size in any dimension
+	template <typename __Val>
+	class _SizeLOD {
+		typedef _Distance<__Val> distance_type;
+		distance_type _size;
+	public:
+		_SizeLOD(const distance_type size) : _size(size) {}
+		template <size_t __K, class __Object, class __Sync, class __Aggregate> 
+			bool operator()( const _Node<__K, __Object, __Sync, __Aggregate>& node, size_t ) const { 
+				for (size_t __i = 0; __i != __K; ++__i) 
+					if ( distance_type(node._M_box._M_high_bounds[__i]) - node._M_box._M_low_bounds[__i] > _size ) return false;
+				return true;
+			} 
+	};
 	
 	class _TrueFunctor{
 	public:
-	template <size_t __K, typename __Val, class __Sync> 
-		bool operator()( const _Node<__K,  __Val,  __Sync>& ) const { return true; } 
+	template <size_t __K, typename __Val, class __Sync, class __Aggregate> 
+		bool operator()( const _Node<__K,  __Val,  __Sync, __Aggregate>& ) const { return true; } 
+	template <typename __Object> 
+		bool operator()( const __Object& ) const { return true; } 
 	};
 	
 }
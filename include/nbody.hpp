@@ -0,0 +1,64 @@
+#ifndef INCLUDE_OCTTREE_NBODY_HPP
+#define INCLUDE_OCTTREE_NBODY_HPP
+
+#include <array>
+#include <cmath>
+
+namespace OCTree {
+	//Aggregate policy which keeps the monopole (total mass and center of mass) of a branch
+	//It is required by OCTree::evaluate
+	//__Position maps an object to std::array<__Type, __K>, __Mass maps an object to its mass
+	template <size_t const __K, typename __Type, class __Position, class __Mass>
+	struct monopole_aggregate {
+		struct value_type {
+			value_type() : _M_mass(), _M_moment() {}
+			__Type                  mass  () const { return _M_mass; }
+			std::array<__Type, __K> center() const {
+				std::array<__Type, __K> result = _M_moment;
+				if ( _M_mass != 0 ) 
+					for ( size_t dim = 0; dim < __K; dim++ ) result[dim] /= _M_mass;
+				return result;
+			}
+			__Type                  _M_mass;
+			std::array<__Type, __K> _M_moment;
+		};
+		template <typename __Object>
+		static value_type from_object(const __Object& object) {
+			value_type              value;
+			std::array<__Type, __K> position = __Position()(object);
+			value._M_mass = __Mass()(object);
+			for ( size_t dim = 0; dim < __K; dim++ ) value._M_moment[dim] = value._M_mass*position[dim];
+			return value;
+		}
+		static value_type combine (const value_type& a, const value_type& b) {
+			value_type value;
+			value._M_mass = a._M_mass + b._M_mass;
+			for ( size_t dim = 0; dim < __K; dim++ ) value._M_moment[dim] = a._M_moment[dim] + b._M_moment[dim];
+			return value;
+		}
+		static value_type identity() { return value_type(); }
+	};
+	//Kernel of OCTree::evaluate
+	//Accumulates the Plummer-softened gravitational acceleration of a target point caused by a point mass
+	template <size_t const __K, typename __Type>
+	struct gravity_kernel {
+		typedef std::array<__Type, __K> result_type;
+		typedef std::array<__Type, __K> point_type;
+		
+		gravity_kernel(const __Type G = 1, const __Type softening = 0) : _G(G), _softening2(softening*softening) {}
+		void operator() (result_type& result, const point_type& target, const point_type& source, const __Type mass) const {
+			point_type delta;
+			__Type     distance2 = _softening2;
+			for ( size_t dim = 0; dim < __K; dim++ ) {
+				delta[dim] = source[dim] - target[dim];
+				distance2 += delta[dim]*delta[dim];
+			}
+			if ( distance2 == 0 ) return;
+			const __Type factor = _G*mass/(distance2*std::sqrt(distance2));
+			for ( size_t dim = 0; dim < __K; dim++ ) result[dim] += factor*delta[dim];
+		}
+	private:
+		__Type _G, _softening2;
+	};
+}
+#endif //INCLUDE_OCTTREE_NBODY_HPP
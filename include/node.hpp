@@ -7,17 +7,44 @@
 #include <vector>
 
 #include "thread.hpp"
+#include "buffer.hpp"
+#include "aggregate.hpp"
 
 namespace OCTree {
 	template<size_t i> struct power{ static const size_t result = 2 * power<i-1>::result; };
 	template<> struct power<1> { static const size_t result = 2; };
+
+	template<size_t... I> struct index_sequence {};
+	template<size_t N, size_t... I> struct make_index_sequence : make_index_sequence<N - 1, N - 1, I...> {};
+	template<size_t... I> struct make_index_sequence<0, I...> { typedef index_sequence<I...> type; };
+
+	//Sign of the dimension dim of the child row of a D-dimensional node
+	//A line is {-1}, {1}, a plane is walked in Gray order, a higher dimension takes the lower half of the first
+	//dimension over the table of D-1 dimensions, then the upper half over the same table
+	constexpr int cartesian_sign(size_t D, size_t row, size_t dim) {
+		return D == 1   ? ( row == 0 ? -1 : 1 ) :
+		       D == 2   ? ( dim == 0 ? ( row == 1 || row == 2 ? 1 : -1 ) : ( row < 2 ? -1 : 1 ) ) :
+		       dim == 0 ? ( row < ( size_t(1) << (D - 1) ) ? -1 : 1 ) :
+		                  cartesian_sign(D - 1, row % ( size_t(1) << (D - 1) ), dim - 1);
+	}
+	template<size_t D, size_t... Dim> 
+		constexpr std::array<int, D> cartesian_row(size_t row, index_sequence<Dim...>) {
+			return {{ cartesian_sign(D, row, Dim)... }};
+		}
+	template<size_t D, size_t... Row> 
+		constexpr std::array<std::array<int, D>, sizeof...(Row)> cartesian_table(index_sequence<Row...>) {
+			return {{ cartesian_row<D>(Row, typename make_index_sequence<D>::type())... }};
+		}
+	//Signs of child nodes, generated at compile time for any dimension
 	template<size_t D> struct cartesian_product { 
-		static const std::array<std::array<int,D>, power<D>::result > product;
+		static constexpr std::array<std::array<int,D>, power<D>::result > product = cartesian_table<D>( typename make_index_sequence<power<D>::result>::type() );
 		typedef typename std::array<std::array<int,D>, power<D>::result >::iterator iterator;
 		typedef typename std::array<std::array<int,D>, power<D>::result >::const_iterator const_iterator;
 	};
+	template<size_t D> 
+		constexpr std::array<std::array<int,D>, power<D>::result > cartesian_product<D>::product;
 	
-	template <size_t __K, typename __Val, class __Sync>
+	template <size_t __K, typename __Val, class __Sync, class __Aggregate = empty_aggregate>
 		struct _Node {
 		   	typedef __Val                                         			        object_type;
 		   	typedef const __Val                                                       object_const_type;
@@ -25,10 +52,12 @@ namespace OCTree {
 			typedef const __Val&                                                 object_const_reference;
 			typedef typename __Val::value_type                                               value_type;
 			typedef __Sync                                                             sync_object_type;
+			typedef __Aggregate                                                          aggregate_type;
+			typedef typename __Aggregate::value_type                               aggregate_value_type;
 			typedef typename std::array<_Node*, power<__K>::result>::iterator             node_iterator;
 			typedef typename std::array<_Node*, power<__K>::result>::const_iterator node_const_iterator;
-			typedef typename std::vector<object_type>::iterator                           data_iterator;
-			typedef typename std::vector<object_type>::const_iterator               data_const_iterator;
+			typedef typename append_vector<object_type>::iterator                         data_iterator;
+			typedef typename append_vector<object_type>::const_iterator             data_const_iterator;
 		 	typedef typename std::array<value_type, __K>                                     query_type; 
 			
 			struct STATE { 
@@ -44,14 +73,26 @@ namespace OCTree {
 
 			_Node*                                      _M_parent;                                
 			std::array<_Node*, power<__K>::result> 	    _M_child;
-			std::vector<__Val>                          _M_data;
+			//Objects are appended without locking, optimization compacts them into a flat array
+			append_vector<__Val>                        _M_data;
+			//Number of objects stored in the branch, copies of an object in several leaf nodes are counted each
+			std::atomic<size_t>                         _M_count;
+			//Number of objects whose first copy (in the depth-first order of leaf nodes) is stored in the branch
+			std::atomic<size_t>                         _M_objects;
+			//Summary of objects whose first copy is stored in the branch, so each object is summarized once
+			aggregate_value_type                        _M_aggregate;
+			//Bumped by inserts into the branch while the query cache of OCTree is on
+			std::atomic<size_t>                         _M_generation;
 			_Box<__K, value_type>                       _M_box;
 		private:
 				_Node(const _Node&);
 				_Node& operator=(const _Node&);
 		public:
-			_Node() : _M_state(),  _M_mutex(), _M_parent(), _M_child(), _M_data(), _M_box()  {
+			_Node() : _M_state(),  _M_mutex(), _M_parent(), _M_child(), _M_data(), _M_count(), _M_objects(), _M_aggregate(__Aggregate::identity()), _M_generation(), _M_box()  {
 				_M_state  = STATE::M_DEFAULT;
+				_M_count  = 0;
+				_M_objects = 0;
+				_M_generation = 0;
 				_M_parent = nullptr;
 				std::fill( _M_child.begin(), _M_child.end(), nullptr);
 			}
@@ -62,13 +103,22 @@ namespace OCTree {
 				std::fill( _M_child.begin(), _M_child.end(), nullptr);
 			}
 			inline void Insert(object_const_reference __Object) {
-				std::unique_lock<sync_object_type> lock( _M_mutex );
 				_M_data.push_back(__Object);
 				return;		
 			}
+			inline void Aggregate(const aggregate_value_type& value) {
+				std::unique_lock<sync_object_type> lock( _M_mutex );
+				_M_aggregate = __Aggregate::combine(_M_aggregate, value);
+				return;		
+			}
 			inline void sortData() {
 				std::unique_lock<sync_object_type> lock(_M_mutex);
-				std::sort(_M_data.begin(), _M_data.end());
+				_M_data.sort();
+				return;
+			}
+			inline void swapData(std::vector<__Val>& data) {
+				std::unique_lock<sync_object_type> lock(_M_mutex);
+				_M_data.swap(data);
 				return;
 			}
 			inline void clearData() {
@@ -77,39 +127,49 @@ namespace OCTree {
 				//std::vector<object_type>().swap(_Node->_M_data);
 				return;
 			}
+			//Child nodes and the parent are replaced under the write side, so node predicates see whole child arrays
+			inline void setChildren(const std::array<_Node*, power<__K>::result>& child) {
+				std::unique_lock<sync_object_type> lock(_M_mutex);
+				_M_child = child;
+				return;
+			}
+			inline void setParent(_Node* parent) {
+				std::unique_lock<sync_object_type> lock(_M_mutex);
+				_M_parent = parent;
+				return;
+			}
+			//Runs a reader under the read side of the sync object (shared lock, seqlock validation or exclusive lock)
+			//Only the predicates below and aggregateValue() read through it; traversals of queries read child arrays and 
+			//objects directly, since child arrays of a tree which queries read change only by optimize(), which must not 
+			//run concurrently with queries, and objects are appended to append_vector, which readers see once published
+			template <class __Reader>
+				inline auto read(const __Reader& reader) const -> decltype(reader()) {
+					return sync_traits<sync_object_type>::read(_M_mutex, reader);
+				}
+			//Copy of the summary of the branch
+			inline aggregate_value_type aggregateValue() const {
+				return read( [this] () { return _M_aggregate; } );
+			}
 			//Check that the node is a root node
 			inline bool isRootNode     () const { 
-				std::unique_lock<sync_object_type> lock( _M_mutex );
-				return _M_parent   == nullptr;          
+				return read( [this] () { return _M_parent == nullptr; } );
 			}
 			//Check that the node is a internal node
 			inline bool isInternalNode () const { 
-				std::unique_lock<sync_object_type> lock( _M_mutex );
-				bool flag_root_node = ( _M_parent == nullptr );
-				bool flag_leaf_node = true;
-				node_const_iterator it_node;
-				node_const_iterator begin_node = _M_child.begin();
-				node_const_iterator end_node   = _M_child.end();
-				for ( it_node = begin_node; it_node != end_node && flag_leaf_node ; ++it_node ) 
-					flag_leaf_node &= (*it_node) == nullptr;
-				return !flag_root_node && !flag_leaf_node;
+				return read( [this] () { return _M_parent != nullptr && !_M_no_children(); } );
 				//return !isRootNode() && !isLeafNode();  
 			}
 			//Check that the node is an empty leaf node
 			inline bool isEmptyLeafNode() const { 
-				std::unique_lock<sync_object_type> lock( _M_mutex );
-				bool flag_leaf_node = true;
-				node_const_iterator it_node;
-				node_const_iterator begin_node = _M_child.begin();
-				node_const_iterator end_node   = _M_child.end();
-				for ( it_node = begin_node; it_node != end_node && flag_leaf_node ; ++it_node ) 
-					flag_leaf_node &= (*it_node) == nullptr;
-				return flag_leaf_node && _M_data.empty();
+				return read( [this] () { return _M_no_children() && _M_data.empty(); } );
 				//return isLeafNode() && _M_data.empty(); 
 			}
 			//Check that the node is a leaf node
 			inline bool isLeafNode() const {
-				std::unique_lock<sync_object_type>  lock( _M_mutex );
+				return read( [this] () { return _M_no_children(); } );
+			}
+		private:
+			inline bool _M_no_children() const {
 				bool flag = true;
 				node_const_iterator it_node;
 				node_const_iterator begin_node = _M_child.begin();
@@ -118,6 +178,7 @@ namespace OCTree {
 					flag &= (*it_node) == nullptr;
 				return flag;
 			}
+		public:
 #ifdef OCTTREE_DEFINE_OSTREAM_OPERATORS
 			template <typename Char, typename Traits>
 				friend
@@ -7,10 +7,13 @@
 #include <array>
 #include <algorithm>
 #include <functional>
+#include <type_traits>
 #ifdef max
 #undef max 
 #endif
 #include <limits.h>
+#include <limits>
+#include <cmath>
 #include <stack>
 
 #include <fstream>
@@ -23,6 +26,7 @@
 #include "box.hpp"
 #include "functor.hpp"
 #include "node.hpp"
+#include "cache.hpp"
 
 namespace OCTree {
 
@@ -43,32 +47,43 @@ template <typename type> struct max {
 		return a;
 	};
 		
+	template < size_t const __K, typename __Val, class __Sync, class __Aggregate > class ShardedOCTree;
 	//Main class 
 	//template < size_t const __K, typename __Val, class __Sync >
-	template < size_t const __K, typename __Val, class __Sync = empty_sync_object >
+	//__Aggregate is a policy which keeps a summary of objects of each branch (see aggregate.hpp)
+	template < size_t const __K, typename __Val, class __Sync = empty_sync_object, class __Aggregate = empty_aggregate >
 	//template < size_t const __K, typename __Val, class __Sync = spin_lock_sync_object >
 		class OCTree {
 			private:
 				OCTree  (const OCTree&);
 				OCTree& operator=(const OCTree&);
+				//join descends into the structure of another OCTree
+				template < size_t const _K, typename _Val, class _Sync, class _Aggregate > friend class OCTree;
+				//Shards of ShardedOCTree are queried only if their roots pass a query
+				template < size_t const _K, typename _Val, class _Sync, class _Aggregate > friend class ShardedOCTree;
 			public:
 				typedef       size_t                           size_type;
 				typedef const size_t                           size_const_type;
 				typedef       typename __Val::value_type       value_type;
 				typedef const typename __Val::value_type       value_const_type;
+				//Squared distances, radii and factors, double for integer coordinates
+				typedef       _Distance<value_type>            distance_type;
+				typedef const _Distance<value_type>            distance_const_type;
 				typedef       __Val                            object_type;	  
 				typedef const __Val                            object_const_type;	  
 				typedef       __Val&                           object_reference;
 				typedef const __Val&                           object_const_reference;
 				typedef       _Box<__K, value_type>            box_type;
 				typedef const _Box<__K, value_type>            box_const_type;
-				typedef       _Node<__K, __Val, __Sync>        node_type;
-				typedef const _Node<__K, __Val, __Sync>        node_const_type;
-				typedef       _Node<__K, __Val, __Sync>*       link_type;
-				typedef const _Node<__K, __Val, __Sync>*       link_const_type;
+				typedef       _Node<__K, __Val, __Sync, __Aggregate>  node_type;
+				typedef const _Node<__K, __Val, __Sync, __Aggregate>  node_const_type;
+				typedef       _Node<__K, __Val, __Sync, __Aggregate>* link_type;
+				typedef const _Node<__K, __Val, __Sync, __Aggregate>* link_const_type;
 				typedef       std::array<value_type, __K>      query_type;
 				typedef const std::array<value_type, __K>      query_const_type;
 				typedef __Sync                                 sync_object_type;
+				typedef __Aggregate                            aggregate_type;
+				typedef typename __Aggregate::value_type       aggregate_value_type;
 
 				std::atomic<bool>   optimized;
 #ifdef OCTTREE_DEFINE_TIMERS
@@ -82,7 +97,9 @@ template <typename type> struct max {
 				std::atomic<size_t> max_query_time_find_if;
 				size_t optimize_time;
 #endif
-				OCTree( const box_type& box, const size_t height = 4 ) : optimized(false)
+				//loose_factor > 1 turns on the loose mode: each object is stored once in the deepest node
+				//whose box enlarged by loose_factor contains it, and all node boxes are enlarged the same way
+				OCTree( const box_type& box, const size_t height = 4, distance_const_type loose_factor = 1 ) : optimized(false)
 #ifdef OCTTREE_DEFINE_TIMERS
 					,min_query_time_find_exact    (std::numeric_limits<size_type>::max()),  max_query_time_find_exact    (0)
 					,min_query_time_find_nearest  (std::numeric_limits<size_type>::max()),  max_query_time_find_nearest  (0)
@@ -96,23 +113,89 @@ template <typename type> struct max {
 			                ,pre_optimize_barrier ()
 					,optimize_barrier     ()
 					,post_optimize_barrier()
+					,_M_optimizers        (0)
+					,_M_optimize_calls    (0)
+					,_M_optimize_mutex    ()
+					,_M_optimize_ended    ()
 					,_M_root              (nullptr)
+					,_M_revision          (0)
+					,_M_loose_factor      (loose_factor)
+					,_M_pool              ()
+					,_M_chunk_size        (256)
+					,_M_auto_grow         (false)
+					,_M_exclusive         (false)
+					,_M_inserters         ()
+					,_M_exclusive_mutex   ()
+					,_M_async_mutex       ()
+					,_M_logging           (false)
+					,_M_log_mutex         ()
+					,_M_log               ()
+					,_M_epoch             (0)
+					,_M_readers           ()
+					,_M_memory_budget     (0)
+					,_M_generation        (0)
+					,_M_cache             ()
+					,_M_cache_quantum     (0)
 				{ _M_build_tree(box, height);  }
 
-				~OCTree() { delete _M_root; }
+				~OCTree() { 
+					delete _M_get_root(); 
+				}
 				//Inserts __Object in OCTree structure 
 				void insert(object_const_reference __Object) {
+					_M_enter_insert();
+					//The root is tested inside of the gate, so it is not replaced before the insert; optimize_async can
+					//replace a grown root while the gate is left, so the test is repeated
+					while ( _M_auto_grow && !_M_is_inside( __Object, _M_get_root()->_M_box ) ) {
+						_M_leave_insert();
+						const bool reached = _M_grow(__Object);
+						_M_enter_insert();
+						if ( !reached ) break;
+					}
 					optimized = false;
-					return _M_insert(_M_get_root(), __Object);
+					_M_insert_root(__Object);
+					//optimize_async replays objects inserted during a background optimization into the new tree
+					//The fence orders the insert before the test, so the copy of the tree sees an insert which is not logged
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if ( _M_logging ) {
+						std::lock_guard<std::mutex> lock( _M_log_mutex );
+						_M_log.push_back(__Object);
+					}
+					_M_leave_insert();
 				}
+				//Objects outside of the root box make the root grow towards them instead of being dropped
+				//The old root becomes a child node of the new root, existing nodes are not re-inserted
+				void auto_grow(bool enable = true) { _M_auto_grow = enable; }
+				//Limits bytes of nodes and their objects (as size_of_all counts them) which optimization may use, 0 is no limit
+				//Leaves are split densest first while splits fit into the budget; a tree over the budget (a deep initial
+				//grid, growth) is collapsed back, sparsest branches first, so the tree degrades to fewer and larger leaves
+				void memory_budget(size_type bytes) { _M_memory_budget = bytes; }
+				size_type memory_budget() const { return _M_memory_budget; }
+				//Keeps results of find_in and find_nearest_s for up to capacity queries, 0 turns the cache off
+				//Bounds of boxes are snapped outward to multiples of quantum (0 keeps them), so close boxes share a result,
+				//which is the result of the snapped box and contains all objects of the original one
+				//Keys of find_nearest_s are the exact query point and radius: the closest leaf nodes of a snapped point are
+				//not those of the original one, so only repeated queries of the same point hit
+				//Inserts invalidate results of queries which overlap the branches of the root they change, optimization and
+				//other changes of OCTree structure invalidate all results; must not be called concurrently with other members
+				void query_cache(size_type capacity, distance_const_type quantum = 0) {
+					_M_cache.reset( capacity > 0 ? new _M_cache_type(capacity) : nullptr );
+					_M_cache_quantum = quantum;
+				}
+				size_type query_cache_hits  () const { return _M_cache != nullptr ? _M_cache->hits  () : 0; }
+				size_type query_cache_misses() const { return _M_cache != nullptr ? _M_cache->misses() : 0; }
 				//Traverses through OCTree structure 
 				//Finds the closest leaf node to a query point
 				//Returns all objects which are stored in the closest leaf node
 				std::vector<object_type> find_exact(query_const_type& point) {
+					_M_reader_guard reader(*this);
+					//Enlarged boxes overlap, so all nodes which contain the query point are candidates
+					if ( _M_is_loose() ) 
+						return find_if(_PointFunctor<__K, value_type>(point));
 #ifdef OCTTREE_DEFINE_TIMERS
 					const std::chrono::high_resolution_clock::time_point start_ = std::chrono::high_resolution_clock::now();
 #endif
-					link_const_type   _Node   = _M_find_exact(_M_root, point);
+					link_const_type   _Node   = _M_find_exact(_M_get_root(), point);
 					if   (_Node == nullptr ) return std::vector<object_type>();
 					else {
 #ifdef OCTTREE_DEFINE_TIMERS
@@ -121,19 +204,51 @@ template <typename type> struct max {
 						max_query_time_find_exact.store( std::max( max_query_time_find_exact.load(), query_time ), std::memory_order_relaxed);
 						min_query_time_find_exact.store( std::min( min_query_time_find_exact.load(), query_time ), std::memory_order_relaxed);
 #endif
-						return _Node->_M_data;
+						return std::vector<object_type>( _Node->_M_data.begin(), _Node->_M_data.end() );
+					}
+				};
+				//Leaf node reached by the previous find_exact call
+				//Lets a coherent sequence of queries start near the previous answer instead of the root
+				struct cursor_type {
+					cursor_type() : _M_node(nullptr), _M_revision(0) {}
+					link_const_type _M_node;
+					size_type       _M_revision;
+				};
+				//Traverses through OCTree structure starting from the cursor node
+				//Climbs to the first ancestor which contains a query point and descends from it
+				//Returns all objects which are stored in the closest leaf node and moves the cursor there
+				std::vector<object_type> find_exact(query_const_type& point, cursor_type& cursor) {
+					_M_reader_guard reader(*this);
+					if ( _M_is_loose() ) 
+						return find_exact(point);
+#ifdef OCTTREE_DEFINE_TIMERS
+					const std::chrono::high_resolution_clock::time_point start_ = std::chrono::high_resolution_clock::now();
+#endif
+					link_const_type   _Node   = _M_find_exact(cursor, point);
+					if   (_Node == nullptr ) return std::vector<object_type>();
+					else {
+						cursor._M_node     = _Node;
+						cursor._M_revision = _M_revision;
+#ifdef OCTTREE_DEFINE_TIMERS
+						const std::chrono::high_resolution_clock::time_point end_ = std::chrono::high_resolution_clock::now();
+						const size_t query_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end_ - start_).count(); 
+						max_query_time_find_exact.store( std::max( max_query_time_find_exact.load(), query_time ), std::memory_order_relaxed);
+						min_query_time_find_exact.store( std::min( min_query_time_find_exact.load(), query_time ), std::memory_order_relaxed);
+#endif
+						return std::vector<object_type>( _Node->_M_data.begin(), _Node->_M_data.end() );
 					}
 				};
 				//Traverses through OCTree structure 
 				//Finds the closest leaf node to a query point
 				//Returns all objects which are stored in the closest leaf node
-				std::vector<object_type> find_nearest(query_const_type& point, value_const_type radius = std::numeric_limits<double>::max() ) {
+				std::vector<object_type> find_nearest(query_const_type& point, distance_const_type radius = std::numeric_limits<distance_type>::max() ) {
+					_M_reader_guard reader(*this);
 					link_const_type   _Node = nullptr;
 #ifdef OCTTREE_DEFINE_TIMERS
 					const std::chrono::high_resolution_clock::time_point start_ = std::chrono::high_resolution_clock::now();
 #endif
-					if (radius == 0) _Node = _M_find_exact(_M_root, point);
-					else _Node = _M_find_nearest(_M_root, point, radius);
+					if (radius == 0) _Node = _M_find_exact(_M_get_root(), point);
+					else _Node = _M_find_nearest(_M_get_root(), point, radius);
 					if   (_Node == nullptr ) return std::vector<object_type>();
 					else {
 #ifdef OCTTREE_DEFINE_TIMERS
@@ -142,91 +257,357 @@ template <typename type> struct max {
 						max_query_time_find_nearest.store( std::max( max_query_time_find_nearest.load(), query_time), std::memory_order_relaxed);
 						min_query_time_find_nearest.store( std::min( min_query_time_find_nearest.load(), query_time), std::memory_order_relaxed);
 #endif
-						return _Node->_M_data;  
+						return _M_nearest_objects(_Node);
 					}
 				};
+				//Runs find_exact for each of points, descents of up to group queries advance by one level in turns
+				//Child nodes which a query descends into are prefetched, so their cache misses overlap with the other queries
+				//Returns the objects which find_exact returns for each point
+				std::vector< std::vector<object_type> > find_exact(const std::vector<query_type>& points, size_t group = 8) {
+					_M_reader_guard reader(*this);
+					std::vector< std::vector<object_type> > output( points.size() );
+					if ( _M_is_loose() ) {
+						for ( size_type index = 0; index < points.size(); ++index ) 
+							output[index] = find_exact(points[index]);
+						return output;
+					}
+					std::vector<link_const_type> leaves;
+					_M_find_group( points, group, leaves, [this] (link_const_type _Node, query_const_type& point, link_const_type&, link_const_type& _Leaf) {
+						return _M_find_exact_step(_Node, point, _Leaf);
+					} );
+					for ( size_type index = 0; index < points.size(); ++index ) 
+						if ( leaves[index] != nullptr ) output[index].assign( leaves[index]->_M_data.begin(), leaves[index]->_M_data.end() );
+					return output;
+				}
+				//Runs find_nearest for each of points in groups, as find_exact for points does
+				std::vector< std::vector<object_type> > find_nearest(const std::vector<query_type>& points, distance_const_type radius = std::numeric_limits<distance_type>::max(), size_t group = 8) {
+					_M_reader_guard reader(*this);
+					std::vector< std::vector<object_type> > output( points.size() );
+					std::vector<link_const_type> leaves;
+					if ( radius == 0 ) 
+						_M_find_group( points, group, leaves, [this] (link_const_type _Node, query_const_type& point, link_const_type&, link_const_type& _Leaf) {
+							return _M_find_exact_step(_Node, point, _Leaf);
+						} );
+					else 
+						_M_find_group( points, group, leaves, [this, radius] (link_const_type _Node, query_const_type& point, link_const_type& _Fallback, link_const_type& _Leaf) {
+							return _M_find_nearest_step(_Node, point, radius, _Fallback, _Leaf);
+						} );
+					for ( size_type index = 0; index < points.size(); ++index ) 
+						if ( leaves[index] != nullptr ) output[index] = _M_nearest_objects(leaves[index]);
+					return output;
+				}
+				//Traverses through OCTree structure by branch-and-bound, the closest nodes are visited first
+				//distance(object, point) returns the squared distance between an object and a query point
+				//Nodes whose squared distance exceeds best/(1+epsilon)^2 are pruned, epsilon = 0 gives the exact answer
+				//Returns the closest object and its squared distance, objects at equal distances are ordered by operator<
+				template <class _Distance>
+					std::vector< std::pair<object_type, distance_type> > find_nearest_object(query_const_type& point, const _Distance& distance, distance_const_type epsilon = 0) const {
+						_M_reader_guard reader(*this);
+						std::vector< std::pair<object_type, distance_type> > output;
+						_M_scratch_guard scratch;
+						_M_find_nearest_object(*scratch, point, distance, 1/((1 + epsilon)*(1 + epsilon)), output);
+						return output;
+					}
+				//Traverses through OCTree structure, branches outside of a sphere are pruned by _SphereFunctor
+				//distance(object, point) returns the squared distance between an object and a query point
+				//Objects of branches inside of the sphere are accepted without the radius test; distance is still called for
+				//every object of the visited nodes, as results carry distances
+				//Returns objects within the radius with their squared distances, sorted by distance (then by operator<) or 
+				//unsorted; objects stored in several leaf nodes are reported once
+				template <class _Distance>
+					std::vector< std::pair<object_type, distance_type> > find_within(query_const_type& point, distance_const_type radius, const _Distance& distance, bool sorted = true) const {
+						std::vector< std::pair<object_type, distance_type> > output;
+						find_within(point, radius, distance, output, sorted);
+						return output;
+					}
+				//Same as find_within, pairs are written into a caller-supplied buffer
+				template <class _Distance>
+					void find_within(query_const_type& point, distance_const_type radius, const _Distance& distance, std::vector< std::pair<object_type, distance_type> >& output, bool sorted = true) const {
+						_M_reader_guard reader(*this);
+						typedef std::pair<object_type, distance_type> result_type;
+						output.clear();
+						{
+							_M_scratch_guard scratch;
+							_M_find_within(*scratch, point, radius*radius, distance, output);
+						}
+						auto same = [] (const result_type& a, const result_type& b) { return !(a.first < b.first) && !(b.first < a.first); };
+						if ( sorted ) {
+							std::sort( output.begin(), output.end(), [] (const result_type& a, const result_type& b) { 
+								return a.second < b.second || ( !(b.second < a.second) && a.first < b.first ); 
+							} );
+							output.erase( std::unique( output.begin(), output.end(), same ), output.end() );
+						} else if ( !_M_is_loose() ) {
+							//Objects are stored once in loose mode, otherwise duplicates are removed by ordering objects
+							std::sort( output.begin(), output.end(), [] (const result_type& a, const result_type& b) { return a.first < b.first; } );
+							output.erase( std::unique( output.begin(), output.end(), same ), output.end() );
+						}
+					}
 				//Traverses through OCTree structure 
 				//Finds the closest leaf nodes to a query point
 				//Returns all objects which are stored in the closest leaf nodes
-				std::vector<object_type> find_nearest_s(query_const_type& _M_query_point, value_const_type _M_query_radius = std::numeric_limits<double>::max() ) {
-					link_const_type   _Node   = _M_root;
+				std::vector<object_type> find_nearest_s(query_const_type& _M_query_point, distance_const_type _M_query_radius = std::numeric_limits<distance_type>::max() ) {
+					std::vector<object_type> output;
+					find_nearest_s(_M_query_point, _M_query_radius, output);
+					return output;
+				};
+				//Same as find_nearest_s, objects are written into a caller-supplied buffer
+				//The buffer keeps its capacity, so repeated queries do not allocate memory
+				void find_nearest_s(query_const_type& _M_query_point, distance_const_type _M_query_radius, std::vector<object_type>& output) {
+					_M_reader_guard reader(*this);
+					std::vector<distance_type> key;
+					_M_cache_entry             entry;
+					if ( _M_cache != nullptr ) {
+						key.push_back(1);
+						key.insert( key.end(), _M_query_point.begin(), _M_query_point.end() );
+						key.push_back(_M_query_radius);
+						//Branches farther than the radius are pruned, so inserts into them do not change the result
+						if ( _M_cached(key, output, entry, [&] (link_const_type _Node) { 
+							return _M_query_radius == std::numeric_limits<distance_type>::max() || _Node->_M_box.shortest_distance(_M_query_point) <= _M_query_radius; 
+						} ) ) return;
+					}
 #ifdef OCTTREE_DEFINE_TIMERS
 					const std::chrono::high_resolution_clock::time_point start_ = std::chrono::high_resolution_clock::now();
 #endif
-					std::vector< link_const_type > _Input; _Input.push_back(_Node);
-					_Input = _M_find_nearest_s(_Input, _M_query_point, _M_query_radius );
-					typename std::vector< link_const_type >::const_iterator it_result;
-					typename std::vector< link_const_type >::const_iterator begin_result = _Input.begin();
-					typename std::vector< link_const_type >::const_iterator end_result   = _Input.end();
-					size_t size = 0;
-					for (it_result = begin_result; it_result != end_result; ++it_result) 
-						size += (*it_result)->_M_data.size();
-
-					std::vector<object_type> output;
-					std::vector<object_type> temp;
-					output.reserve( size );
-					temp.reserve( size );
-
-					for (it_result = begin_result; it_result != end_result; ++it_result) {
-						typename node_type::data_const_iterator it_data;
-						typename node_type::data_const_iterator begin_data = (*it_result)->_M_data.begin();
-						typename node_type::data_const_iterator end_data   = (*it_result)->_M_data.end();
-						if(optimized) {
-							std::merge(output.begin(), output.end(), begin_data, end_data, std::back_inserter(temp) );
-							std::swap(output, temp);
-							temp.clear();
-						} else {
-							std::copy(begin_data, end_data, std::back_inserter(output) );
-						}
-					}
+					_M_scratch_guard scratch;
+					_M_find_nearest_s(*scratch, _M_query_point, _M_query_radius);
+					_M_collect(*scratch, output);
 #ifdef OCTTREE_DEFINE_TIMERS
 					const std::chrono::high_resolution_clock::time_point end_ = std::chrono::high_resolution_clock::now();
 					const size_t query_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end_ - start_).count(); 
 					max_query_time_find_nearest_s.store( std::max( max_query_time_find_nearest_s.load(), query_time), std::memory_order_relaxed);
 					min_query_time_find_nearest_s.store( std::min( min_query_time_find_nearest_s.load(), query_time), std::memory_order_relaxed);
 #endif
-					return output;
+					if ( _M_cache != nullptr ) 
+						_M_store(key, output, entry);
 				};
 				//Traverses through OCTree structure
 				//Finds all leaf nodes which have intersection an query box
 				//Returns all objects which are stored in these leaf nodes
 				template <class _Functor>
 					std::vector<object_type> find_if (const _Functor& _functor) {
-						link_const_type   _Node   = _M_root;
+						std::vector<object_type> output;
+						find_if(_functor, output);
+						return output;
+					}
+				//Same as find_if, objects are written into a caller-supplied buffer
+				//The buffer keeps its capacity, so repeated queries do not allocate memory
+				template <class _Functor>
+					void find_if (const _Functor& _functor, std::vector<object_type>& output) {
+						_M_reader_guard reader(*this);
 #ifdef OCTTREE_DEFINE_TIMERS
 						const std::chrono::high_resolution_clock::time_point start_ = std::chrono::high_resolution_clock::now();
 #endif
-						box_const_type _box = _Node->_M_box;
-
-						std::vector< link_const_type > _Input; _Input.push_back(_Node);
-						_Input = _M_find_if(_Input, _functor );
-
-						typename std::vector< link_const_type >::const_iterator it_result;
-						typename std::vector< link_const_type >::const_iterator begin_result = _Input.begin();
-						typename std::vector< link_const_type >::const_iterator end_result   = _Input.end();
-						std::vector<object_type> output;
-						std::vector<object_type> temp;
-						for (it_result = begin_result; it_result != end_result; ++it_result) {
-							typename node_type::data_const_iterator it_data;
-							typename node_type::data_const_iterator begin_data = (*it_result)->_M_data.begin();
-							typename node_type::data_const_iterator end_data   = (*it_result)->_M_data.end();
-							if (optimized) {
-								std::merge(output.begin(), output.end(), begin_data, end_data, std::back_inserter(temp));
-								std::swap(output, temp);
-								temp.clear();
-							} else {
-								std::copy(begin_data, end_data, std::back_inserter(output) );
-							}
-						}
+						_M_scratch_guard scratch;
+						_M_find_if(*scratch, _functor);
+						_M_collect(*scratch, output);
 #ifdef OCTTREE_DEFINE_TIMERS
 						const std::chrono::high_resolution_clock::time_point end_ = std::chrono::high_resolution_clock::now();
 						const size_t query_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end_ - start_).count(); 
 						max_query_time_find_if.store( std::max( max_query_time_find_if.load(), query_time));
 						min_query_time_find_if.store( std::min( min_query_time_find_if.load(), query_time));
 #endif
-						return output;
 					}
 		
+				//Node found by find_nodes_if: its box, its depth (the root has depth 0) and the number of objects of its branch
+				struct node_handle {
+					box_type  box;
+					size_type depth;
+					size_type count;
+				};
+				//Traverses through OCTree structure
+				//Descends into non-empty nodes for which functor(node) is true until lod_policy(node, depth) is true
+				//(see _DepthLOD and _SizeLOD) or a leaf node is reached, objects are not copied
+				//Objects which an internal node stores itself in loose mode are counted by a handle of the node if it is descended
+				//Returns handles of such nodes in depth-first order
+				template <class _Functor, class _Policy>
+					std::vector<node_handle> find_nodes_if (const _Functor& _functor, const _Policy& lod_policy) const {
+						_M_reader_guard reader(*this);
+						std::vector<node_handle> output;
+						_M_scratch_guard scratch;
+						std::vector< std::pair<link_const_type, size_type> >& stack = scratch->_M_levels;
+						stack.clear();
+						stack.push_back( std::make_pair(_M_get_root(), size_type(0)) );
+						while ( !stack.empty() ) {
+							const std::pair<link_const_type, size_type> top = stack.back();
+							stack.pop_back();
+							link_const_type _Node = top.first;
+							if ( _Node->_M_count == 0 || !_functor(*_Node) ) continue;
+							if ( _Node->isLeafNode() || lod_policy(*_Node, top.second) ) {
+								node_handle handle;
+								handle.box   = _Node->_M_box;
+								handle.depth = top.second;
+								handle.count = _Node->_M_count;
+								output.push_back(handle);
+								continue;
+							}
+							if ( !_Node->_M_data.empty() ) {
+								node_handle handle;
+								handle.box   = _Node->_M_box;
+								handle.depth = top.second;
+								handle.count = _Node->_M_data.size();
+								output.push_back(handle);
+							}
+							for (auto it_node = _Node->_M_child.rbegin(); it_node != _Node->_M_child.rend(); ++it_node ) 
+								stack.push_back( std::make_pair(*it_node, top.second + 1) );
+						}
+						return output;
+					}
+				//Finds all objects stored in nodes which intersect a box, as find_if with _BoxFunctor does
+				//Results are kept by the query cache, if it is turned on
+				std::vector<object_type> find_in (const box_type& box) {
+					std::vector<object_type> output;
+					find_in(box, output);
+					return output;
+				}
+				//Same as find_in, objects are written into a caller-supplied buffer
+				void find_in (const box_type& box, std::vector<object_type>& output) {
+					_M_reader_guard reader(*this);
+					if ( _M_cache == nullptr ) 
+						return find_if(_BoxFunctor<__K, value_type>(box), output);
+					const box_type snapped = _M_snap(box);
+					std::vector<distance_type> key(1, 0);
+					for ( size_t dim = 0; dim < __K; dim++ ) {
+						key.push_back( snapped._M_low_bounds [dim] );
+						key.push_back( snapped._M_high_bounds[dim] );
+					}
+					_M_cache_entry entry;
+					if ( _M_cached(key, output, entry, [&] (link_const_type _Node) { return _Node->_M_box.intersects_with(snapped); } ) ) 
+						return;
+					find_if(_BoxFunctor<__K, value_type>(snapped), output);
+					_M_store(key, output, entry);
+				}
+				//Traverses through OCTree structure
+				//Finds all leaf nodes which have intersection an query box
+				//Returns the number of objects stored in these leaf nodes without copying them
+				//An object stored in several of them (strict mode) is counted once, at the first of them
+				template <class _Functor>
+					size_type count_if (const _Functor& _functor) {
+						_M_reader_guard reader(*this);
+						_M_scratch_guard scratch;
+						_M_find_if(*scratch, _functor);
+
+						size_type count = 0;
+						for (auto it_result = scratch->_M_current.begin(); it_result != scratch->_M_current.end(); ++it_result) 
+							count += _M_count_owned(*it_result, [&_functor] (link_const_type _Node) { return _functor(*_Node); } );
+						for (auto it_result = scratch->_M_inner.begin(); it_result != scratch->_M_inner.end(); ++it_result) 
+							count += (*it_result)->_M_data.size();
+						return count;
+					}
+				//Counts objects stored in nodes which intersect a region (_Box or _Sphere)
+				//Nodes inside of the region are added up by their object counters
+				//Objects of boundary nodes are counted as a whole
+				//An object stored in several leaf nodes (strict mode) is counted once
+				template <class _Region>
+					size_type count_in (const _Region& region) const {
+						_M_reader_guard reader(*this);
+						return _M_count_in(_M_get_root(), region, static_cast<const _TrueFunctor*>(nullptr), static_cast<const _TrueFunctor*>(nullptr));
+					}
+				//Objects of boundary nodes are counted if the exact predicate is true for them
+				template <class _Region, class _Exact>
+					size_type count_in (const _Region& region, const _Exact& exact) const {
+						_M_reader_guard reader(*this);
+						return _M_count_in(_M_get_root(), region, &exact, static_cast<const _TrueFunctor*>(nullptr));
+					}
+
+				//Barnes-Hut evaluation of a kernel at target points (see nbody.hpp)
+				//Requires an aggregate policy with mass() and center() like monopole_aggregate
+				//A branch is treated as a single body at its center of mass if its size is less than theta times the distance to it
+				//A body stored in several leaf nodes (strict mode) acts once, as a part of the first of them
+				//Targets are split between threads
+				template <class _Kernel>
+					std::vector<typename _Kernel::result_type> evaluate (const std::vector<query_type>& targets, distance_const_type theta, const _Kernel& kernel, size_t threads = std::thread::hardware_concurrency()) const {
+						_M_reader_guard reader(*this);
+						std::vector<typename _Kernel::result_type> results( targets.size(), typename _Kernel::result_type() );
+						threads = std::max<size_t>( 1, std::min( threads, targets.size() ) );
+						const size_type chunk = ( targets.size() + threads - 1 )/threads;
+
+						std::vector<std::thread> workers;
+						for ( size_t index = 0; index < threads; ++index ) {
+							const size_type begin = index*chunk;
+							const size_type end   = std::min( targets.size(), begin + chunk );
+							workers.push_back( std::thread( [this, &targets, &results, &kernel, theta, begin, end] () {
+								std::vector<link_const_type> stack;
+								for ( size_type target = begin; target < end; ++target ) 
+									_M_evaluate( targets[target], theta*theta, kernel, results[target], stack );
+							} ) );
+						}
+						for ( auto it_worker = workers.begin(); it_worker != workers.end(); ++it_worker ) 
+							it_worker->join();
+						return results;
+					}
+
+				//Finds all pairs of objects closer than radius to each other, distance(a, b) returns the squared distance between objects
+				//The radius is a distance, not a squared distance
+				//Calls pair_callback(a, b) once for each pair, a < b; an object stored in several leaf nodes (strict mode) is paired
+				//from the first of them only, so pairs are not collected for deduplication
+				//Workers pass pairs to pair_callback in batches as they find them, one batch at a time
+				template <class _Distance, class _Callback>
+					void self_join (distance_const_type radius, const _Distance& distance, const _Callback& pair_callback, size_t threads = std::thread::hardware_concurrency()) const {
+						_M_reader_guard reader(*this);
+						typedef std::pair<object_type, object_type> pair_type;
+						distance_const_type radius2 = radius*radius;
+						//Split the traversal into independent pairs of branches
+						std::vector<_M_join_task> tasks;
+						tasks.push_back( _M_join_task(_M_get_root()) );
+						threads = std::max<size_t>( 1, threads );
+						for ( bool expanded = true; expanded && tasks.size() < 4*threads; ) {
+							std::vector<_M_join_task> next;
+							expanded = false;
+							for ( auto it_task = tasks.begin(); it_task != tasks.end(); ++it_task ) 
+								expanded |= _M_join_expand( *it_task, next );
+							std::swap( tasks, next );
+						}
+						//Process branch pairs in parallel
+						std::mutex  callback_mutex;
+						auto deliver = [&callback_mutex, &pair_callback] (std::vector<pair_type>& output) {
+							std::lock_guard<std::mutex> lock( callback_mutex );
+							for ( auto it_pair = output.begin(); it_pair != output.end(); ++it_pair ) 
+								pair_callback( it_pair->first, it_pair->second );
+							output.clear();
+						};
+						std::atomic<size_type>                next_task( 0 );
+						std::vector<std::thread>              workers;
+						for ( size_t index = 0; index < threads; ++index ) 
+							workers.push_back( std::thread( [this, &tasks, &next_task, &distance, &deliver, radius2] () {
+								_M_join_state<pair_type> state;
+								for ( size_type task = next_task++; task < tasks.size(); task = next_task++ ) 
+									_M_join( tasks[task], radius2, distance, state, deliver );
+								if ( !state._M_output.empty() ) deliver( state._M_output );
+							} ) );
+						for ( auto it_worker = workers.begin(); it_worker != workers.end(); ++it_worker ) 
+							it_worker->join();
+					}
+
+				//Traverses through two OCTree structures simultaneously
+				//Descends into pairs of nodes for which node_pair_predicate(node, other_node) is true
+				//Calls pair_callback(object, other_object) once for each pair of objects of such leaf nodes
+				//The other tree can have another object type, depth and synchronization policy
+				template <class _Tree, class _Predicate, class _Callback>
+					void join (const _Tree& other, const _Predicate& node_pair_predicate, const _Callback& pair_callback) const {
+						_M_reader_guard reader(*this);
+						typename _Tree::_M_reader_guard other_reader(other);
+						typedef std::pair<object_type, typename _Tree::object_type> pair_type;
+						std::vector<pair_type> output;
+						_M_dual_join( _M_get_root(), false, other._M_get_root(), false, node_pair_predicate, output );
+						//Objects stored in several leaf nodes produce the same pair several times
+						if ( !_M_is_loose() || !other._M_is_loose() ) {
+							std::sort( output.begin(), output.end() );
+							output.erase( std::unique( output.begin(), output.end(), [] (const pair_type& a, const pair_type& b) {
+								return !(a < b) && !(b < a);
+							} ), output.end() );
+						}
+						for ( auto it_pair = output.begin(); it_pair != output.end(); ++it_pair ) 
+							pair_callback( it_pair->first, it_pair->second );
+					}
+
+				//Expands wide frontiers of find_if, count_if and find_nearest_s on a pool of threads
+				//Frontiers shorter than 2*chunk_size nodes are expanded by the calling thread, 0 threads turns the mode off
+				//Results are the same as in the serial mode; must not be called concurrently with queries
+				void parallel_queries(size_t threads, size_t chunk_size = 256) {
+					_M_pool.reset( threads > 0 ? new thread_pool(threads) : nullptr );
+					_M_chunk_size = std::max<size_t>( 1, chunk_size );
+				}
+
 				std::atomic<bool>              pre_optimize_flag;
 				std::atomic<bool>                  optimize_flag;
 				std::atomic<bool>             post_optimize_flag;
@@ -234,33 +615,69 @@ template <typename type> struct max {
 				barrier<sync_object_type>   pre_optimize_barrier;
 				barrier<sync_object_type>       optimize_barrier;
 				barrier<sync_object_type>  post_optimize_barrier;
+				//Threads which take part in the running optimize() and the number of ended calls, guarded by _M_optimize_mutex
+				size_type                      _M_optimizers;
+				size_type                      _M_optimize_calls;
+				std::mutex                     _M_optimize_mutex;
+				std::condition_variable        _M_optimize_ended;
+				//Threads which call optimize() together run each phase once: a phase flag is set by the thread which runs
+				//the phase and the barrier of the phase holds the others until it is done
+				//A thread joins the running call only before its first phase is claimed, a later one would skip phases which
+				//ran before it came and run the rest, so it waits until the call has ended and shares its result (returns false);
+				//the last thread which leaves clears the flags, otherwise every later call skipped all phases
+				bool _M_enter_optimize() {
+					std::unique_lock<std::mutex> lock(_M_optimize_mutex);
+					if ( pre_optimize_flag ) {
+						const size_type call = _M_optimize_calls;
+						_M_optimize_ended.wait( lock, [this, call] () { return _M_optimize_calls != call; } );
+						return false;
+					}
+					++_M_optimizers;
+					pre_optimize_barrier .lock();
+					optimize_barrier     .lock();
+					post_optimize_barrier.lock();
+					return true;
+				}
+				void _M_leave_optimize() {
+					std::unique_lock<std::mutex> lock(_M_optimize_mutex);
+					if ( --_M_optimizers != 0 ) return;
+					pre_optimize_flag  = false;
+					optimize_flag      = false;
+					post_optimize_flag = false;
+					++_M_optimize_calls;
+					_M_optimize_ended.notify_all();
+				}
+				//Returns true for the one thread which runs a phase
+				bool _M_claim_phase(std::atomic<bool>& flag) {
+					std::unique_lock<std::mutex> lock(_M_optimize_mutex);
+					return !flag.exchange(true);
+				}
 
 				//Optimize OCTree structure
+				//Must not be called concurrently with queries, it creates and deletes nodes of the tree they read
 				void optimize() {
 #ifdef OCTTREE_DEFINE_TIMERS
 					auto start = std::chrono::high_resolution_clock::now();
 #endif
-					pre_optimize_barrier .lock();
-					optimize_barrier     .lock();
-					post_optimize_barrier.lock();
+					if ( !_M_enter_optimize() ) return;
 					//Pre-optimize
-					if( !pre_optimize_flag ) {
+					if( _M_claim_phase(pre_optimize_flag) ) 
 						_M_pre_optimize ( _M_get_root() );
-						pre_optimize_flag = true;
-					}
 					pre_optimize_barrier.unlock();
 					//Optimize
-					if( !optimize_flag ) { 
-						_M_optimize     ( _M_get_root() );
-						optimize_flag = true;
+					if( _M_claim_phase(optimize_flag) ) { 
+						//Nodes can be removed, so cursors of the previous revision are not valid anymore
+						_M_revision++;
+						_M_generation++;
+						if ( _M_memory_budget != 0 ) _M_optimize_budget( _M_get_root() );
+						else                         _M_optimize       ( _M_get_root() );
 					}
 					optimize_barrier.unlock();
 					//Post-optimize
-					if( !post_optimize_flag ) {
+					if( _M_claim_phase(post_optimize_flag) ) 
 						_M_post_optimize( _M_get_root() );
-						post_optimize_flag = true;
-					}
 					post_optimize_barrier.unlock();
+					_M_leave_optimize();
 #ifdef OCTTREE_DEFINE_TIMERS
 					auto end      = std::chrono::high_resolution_clock::now();
 					auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
@@ -269,11 +686,139 @@ template <typename type> struct max {
 					//Completed optimization
 					optimized = true;
 				};
+				//Optimizes a copy of OCTree structure on background threads and replaces the tree by it
+				//Queries keep running on the current tree; inserts keep running while the tree is copied and optimized,
+				//they are logged and inserted into the new tree as well, and are held back only while the log is replayed
+				//and the root is replaced
+				//The old tree is deleted by the background task once queries which started before the replacement have ended
+				//Must not be called concurrently with optimize()
+				std::future<void> optimize_async() {
+					return std::async( std::launch::async, [this] () {
+						std::lock_guard<std::mutex> lock( _M_async_mutex );
+						//Snapshot: inserts only append objects to nodes, so the tree is copied while they run
+						_M_logging = true;
+						std::atomic_thread_fence(std::memory_order_seq_cst);
+						link_type _Successor = _M_copy( _M_get_root() );
+						//Optimize
+						_M_optimize_parallel(_Successor);
+						//Swap
+						_M_lock_inserts();
+						optimized = !_M_replay(_Successor);
+						_M_log.clear();
+						_M_logging = false;
+						//Cursors keep nodes of the old tree
+						_M_revision++;
+						_M_generation++;
+						link_type _Old = _M_root.exchange(_Successor);
+						_M_unlock_inserts();
+						//Reclaim: queries which start in the next epoch read the new tree
+						const size_type epoch = _M_epoch++;
+						while ( _M_readers[epoch % 2] != 0 ) std::this_thread::yield();
+						delete _Old;
+					} );
+				}
+				//Moves objects which left their nodes after the user has changed them in place
+				//Objects which are still inside of their node (placed there by the insert rules in loose mode) stay,
+				//the other ones are removed, in strict mode with all of their copies, and inserted again starting from
+				//the nearest ancestor which encloses them (see _M_encloses); objects which left the root are handled as insert does
+				//Nodes are checked and objects are inserted by separate threads, splits and merges run once at the end
+				//Inserts run on one thread if the synchronization policy does not lock (empty_sync_object)
+				//Must not be called concurrently with other members
+				void relocate_all(size_t threads = std::thread::hardware_concurrency()) {
+					typedef std::pair<object_type, link_type> moved_type;
+					auto less_object = [] (const moved_type& a, const moved_type& b) { return a.first < b.first; };
+					threads = std::max<size_t>( 1, threads );
+					std::vector<link_type> nodes;
+					_M_visit( _M_get_root(), [&] (link_const_type _Node, size_type) { 
+						if ( !_Node->_M_data.empty() ) nodes.push_back( const_cast<link_type>(_Node) );
+					} );
+					//Check
+					std::vector< std::vector<moved_type> > moved( threads );
+					_M_parallel_for( nodes.size(), threads, [&] (size_type index, size_t worker) {
+						link_type _Node = nodes[index];
+						std::vector<__Val> _Data;
+						_Node->swapData(_Data);
+						auto it_moved = std::partition( _Data.begin(), _Data.end(), [&] (object_const_reference __Object) { return _M_stays(_Node, __Object); } );
+						for ( auto it_data = it_moved; it_data != _Data.end(); ++it_data ) 
+							moved[worker].push_back( moved_type(*it_data, _Node) );
+						_Data.erase( it_moved, _Data.end() );
+						_Node->swapData(_Data);
+					} );
+					std::vector<moved_type> objects;
+					for ( auto it_moved = moved.begin(); it_moved != moved.end(); ++it_moved ) 
+						objects.insert( objects.end(), it_moved->begin(), it_moved->end() );
+					//Number of inserts of each moved object, loose mode stores one copy per insert, so each copy is moved once
+					std::vector<size_type> inserts( objects.size(), 1 );
+					if ( !_M_is_loose() ) {
+						//An insert stores a copy in every leaf node which the object overlaps, so an object inserted several
+						//times has as many copies in each of them; it is kept once with the number of copies in one node
+						auto same_object = [] (const moved_type& a, const moved_type& b) { return !(a.first < b.first) && !(b.first < a.first); };
+						std::sort( objects.begin(), objects.end(), [] (const moved_type& a, const moved_type& b) { 
+							return a.first < b.first || ( !(b.first < a.first) && std::less<link_type>()(a.second, b.second) ); 
+						} );
+						size_type kept = 0;
+						for ( size_type index = 0, next; index < objects.size(); index = next ) {
+							size_type copies = 0;
+							for ( next = index; next < objects.size() && same_object(objects[next], objects[index]); ) {
+								size_type run = next;
+								while ( run < objects.size() && same_object(objects[run], objects[next]) && objects[run].second == objects[next].second ) 
+									++run;
+								copies = std::max( copies, run - next );
+								next   = run;
+							}
+							inserts[kept]   = copies;
+							objects[kept++] = objects[index];
+						}
+						objects.resize(kept);
+						inserts.resize(kept);
+						//Copies of a moved object which stay in other leaf nodes are removed as well
+						if ( !objects.empty() ) 
+							_M_parallel_for( nodes.size(), threads, [&] (size_type index, size_t) {
+								link_type _Node = nodes[index];
+								std::vector<__Val> _Data;
+								_Node->swapData(_Data);
+								_Data.erase( std::remove_if( _Data.begin(), _Data.end(), [&] (object_const_reference __Object) { 
+									return std::binary_search( objects.begin(), objects.end(), moved_type(__Object, nullptr), less_object ); 
+								} ), _Data.end() );
+								_Node->swapData(_Data);
+							} );
+					}
+					//Move
+					//Concurrent inserts change data and summaries of shared nodes, which only a locking policy protects
+					if ( std::is_same<sync_object_type, empty_sync_object>::value ) threads = 1;
+					std::vector< std::vector<object_type> > outside( threads );
+					_M_parallel_for( objects.size(), threads, [&] (size_type index, size_t worker) {
+						object_const_reference __Object = objects[index].first;
+						link_type _Node = objects[index].second;
+						while ( _Node != nullptr && !_M_encloses(_Node, __Object) ) 
+							_Node = _Node->_M_parent;
+						for ( size_type count = 0; count < inserts[index]; ++count ) 
+							if ( _Node == nullptr )   outside[worker].push_back(__Object);
+							else if ( _M_is_loose() ) _M_insert_loose(_Node, __Object);
+							else                      _M_insert      (_Node, __Object);
+					} );
+					for ( auto it_outside = outside.begin(); it_outside != outside.end(); ++it_outside ) 
+						for ( auto it_data = it_outside->begin(); it_data != it_outside->end(); ++it_data ) {
+							if ( _M_auto_grow ) 
+								_M_root = _M_grown( _M_get_root(), *it_data );
+							_M_insert_root(*it_data);
+						}
+					//Counters and summaries of nodes which objects left are rebuilt by the post-optimization
+					_M_pre_optimize(_M_get_root());
+					_M_revision++;
+					_M_generation++;
+					if ( _M_memory_budget != 0 ) _M_optimize_budget( _M_get_root() );
+					else                         _M_optimize       ( _M_get_root() );
+					_M_post_optimize(_M_get_root());
+					optimized = true;
+				}
 				bool empty() const {
-					bool flag =  _M_root == nullptr ||  _M_empty_branch( _M_root); 
+					_M_reader_guard reader(*this);
+					bool flag =  _M_get_root() == nullptr ||  _M_empty_branch( _M_get_root()); 
 					return flag;
 				};
 				size_type size() const {
+					_M_reader_guard reader(*this);
 					return _M_size( _M_get_root() );
 				}
 
@@ -291,134 +836,772 @@ template <typename type> struct max {
 
 				template <class Operator = std::plus<size_type>, class Functor>
 					size_type size_if(Functor func) const {
+						_M_reader_guard reader(*this);
 						return _M_size_if<Operator>(_M_get_root(), func);
 					};
 
+				//Summary of all objects stored in OCTree structure
+				aggregate_value_type aggregate() const {
+					_M_reader_guard reader(*this);
+					return _M_get_root()->aggregateValue();
+				}
+				//Objects in the depth-first order of nodes, objects of a node come before objects of its child nodes
+				//Child nodes are walked in the order of cartesian_product, so neighbour objects are close in the order
+				//An object stored in several leaf nodes is listed once, at the first of them
+				std::vector<object_type> spatial_order() const {
+					_M_reader_guard reader(*this);
+					typedef std::pair<object_type, size_type> entry_type;
+					std::vector<entry_type>      entries;
+					std::vector<link_const_type> stack( 1, _M_get_root() );
+					while ( !stack.empty() ) {
+						link_const_type _Node = stack.back();
+						stack.pop_back();
+						for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data) 
+							entries.push_back( entry_type(*it_data, entries.size()) );
+						if ( !_Node->isLeafNode() ) 
+							stack.insert( stack.end(), _Node->_M_child.rbegin(), _Node->_M_child.rend() );
+					}
+					//Copies of an object in strict mode are merged into the first one
+					if ( !_M_is_loose() ) {
+						std::sort( entries.begin(), entries.end(), [] (const entry_type& a, const entry_type& b) { 
+							return a.first < b.first || ( !(b.first < a.first) && a.second < b.second ); 
+						} );
+						entries.erase( std::unique( entries.begin(), entries.end(), [] (const entry_type& a, const entry_type& b) { 
+							return !(a.first < b.first) && !(b.first < a.first); 
+						} ), entries.end() );
+						std::sort( entries.begin(), entries.end(), [] (const entry_type& a, const entry_type& b) { return a.second < b.second; } );
+					}
+					std::vector<object_type> result;
+					result.reserve( entries.size() );
+					for (auto it_entry = entries.begin(); it_entry != entries.end(); ++it_entry) 
+						result.push_back( it_entry->first );
+					return result;
+				}
+				//Permutation of an array of objects into spatial_order: the i-th object of the order is objects[result[i]]
+				//Objects of the array which are not stored in OCTree structure follow in their own order
+				//Reordering user data by the permutation and calling rebind makes leaf scans walk memory in order
+				std::vector<size_type> spatial_permutation(const std::vector<object_type>& objects) const {
+					std::vector<size_type> index( objects.size() );
+					for ( size_type position = 0; position < objects.size(); ++position ) 
+						index[position] = position;
+					auto less_index = [&objects] (size_type a, size_type b) { return objects[a] < objects[b]; };
+					std::stable_sort( index.begin(), index.end(), less_index );
+
+					const std::vector<object_type> order = spatial_order();
+					std::vector<size_type> result;
+					std::vector<char>      used( objects.size(), 0 );
+					result.reserve( objects.size() );
+					for (auto it_data = order.begin(); it_data != order.end(); ++it_data) {
+						auto it_index = std::lower_bound( index.begin(), index.end(), *it_data, [&objects] (size_type a, object_const_reference __Object) { 
+							return objects[a] < __Object; 
+						} );
+						//Equal objects of the array are taken one by one
+						while ( it_index != index.end() && !(*it_data < objects[*it_index]) && used[*it_index] ) 
+							++it_index;
+						if ( it_index == index.end() || *it_data < objects[*it_index] ) continue;
+						used[*it_index] = 1;
+						result.push_back(*it_index);
+					}
+					for ( size_type position = 0; position < objects.size(); ++position ) 
+						if ( !used[position] ) result.push_back(position);
+					return result;
+				}
+				//Replaces each stored object by rebinder(object), e.g. a wrapper of the same object moved into reordered storage
+				//Nodes are not changed, so the new object must overlap the same nodes as the old one
+				//Must not be called concurrently with other members
+				template <class _Rebinder>
+					void rebind(const _Rebinder& rebinder) {
+						_M_visit( _M_get_root(), [&] (link_const_type _Input, size_type) {
+							link_type _Node = const_cast<link_type>(_Input);
+							if ( _Node->_M_data.empty() ) return;
+							std::vector<__Val> _Data;
+							_Node->swapData(_Data);
+							for (auto it_data = _Data.begin(); it_data != _Data.end(); ++it_data) 
+								*it_data = rebinder(*it_data);
+							//Data of an optimized OCTree is merged by queries, so it stays sorted
+							if ( optimized ) std::sort( _Data.begin(), _Data.end() );
+							_Node->swapData(_Data);
+						} );
+						_M_generation++;
+					}
+				//Forward iterator over leaf nodes in depth-first order (the order of spatial_order)
+				//It walks parent links, so it does not allocate memory; optimization invalidates it
+				//It does not register as a reader, so it must not be used while optimize_async runs
+				class leaf_iterator : public std::iterator<std::forward_iterator_tag, node_type, std::ptrdiff_t, link_const_type, const node_type&> {
+					public:
+						leaf_iterator() : _M_node(nullptr) {}
+						explicit leaf_iterator(link_const_type _Node) : _M_node(_Node) {}
+						const node_type& operator* () const { return *_M_node; }
+						link_const_type  operator->() const { return  _M_node; }
+						leaf_iterator&   operator++()       { _M_node = OCTree::_M_next_leaf(_M_node); return *this; }
+						leaf_iterator    operator++(int)    { leaf_iterator result = *this; ++(*this); return result; }
+						bool operator==(const leaf_iterator& other) const { return _M_node == other._M_node; }
+						bool operator!=(const leaf_iterator& other) const { return _M_node != other._M_node; }
+					private:
+						link_const_type _M_node;
+				};
+				//Forward iterator over objects of nodes in depth-first order, objects of a node come before its child nodes
+				//An object stored in several leaf nodes is visited in each of them, unless duplicates are skipped:
+				//then only the copy of the first leaf node which stores the object is visited (see _M_owns)
+				//Iterators do not register as readers, so they must not be used while optimize_async runs; optimization invalidates them
+				class const_iterator : public std::iterator<std::forward_iterator_tag, object_type, std::ptrdiff_t, const object_type*, object_const_reference> {
+					public:
+						const_iterator() : _M_node(nullptr), _M_data(), _M_end(), _M_unique(false), _M_owned(false) {}
+						const_iterator(link_const_type _Node, bool unique) : _M_node(_Node), _M_data(), _M_end(), _M_unique(unique), _M_owned(false) { 
+							if ( _M_node != nullptr ) _M_enter();
+							_M_settle(); 
+						}
+						object_const_reference operator* () const { return *_M_data; }
+						const object_type*     operator->() const { return &*_M_data; }
+						const_iterator&        operator++()       { ++_M_data; _M_settle(); return *this; }
+						const_iterator         operator++(int)    { const_iterator result = *this; ++(*this); return result; }
+						bool operator==(const const_iterator& other) const { return _M_node == other._M_node && ( _M_node == nullptr || _M_data == other._M_data ); }
+						bool operator!=(const const_iterator& other) const { return !(*this == other); }
+					private:
+						//Moves to the next object to visit, or to the end
+						void _M_settle() {
+							while ( _M_node != nullptr ) {
+								for ( ; _M_data != _M_end; ++_M_data ) 
+									if ( !_M_unique || _M_owned || OCTree::_M_owns(_M_node, *_M_data) ) return;
+								_M_node = OCTree::_M_next_node(_M_node);
+								if ( _M_node != nullptr ) _M_enter();
+							}
+						}
+						//A node whose object counter equals its data size stores first copies only
+						void _M_enter() {
+							_M_data  = _M_node->_M_data.begin();
+							_M_end   = _M_node->_M_data.end();
+							_M_owned = _M_node->_M_objects == _M_node->_M_data.size();
+						}
+						link_const_type                          _M_node;
+						typename node_type::data_const_iterator _M_data;
+						typename node_type::data_const_iterator _M_end;
+						bool                                     _M_unique;
+						bool                                     _M_owned;
+				};
+				//Objects of OCTree structure, see const_iterator; duplicates exist in strict mode only
+				const_iterator begin(bool skip_duplicates = false) const { return const_iterator( _M_get_root(), skip_duplicates && !_M_is_loose() ); }
+				const_iterator end  ()                             const { return const_iterator(); }
+				leaf_iterator  leaf_begin() const { return leaf_iterator( _M_first_leaf(_M_get_root()) ); }
+				leaf_iterator  leaf_end  () const { return leaf_iterator(); }
 				size_type max_height() const {
+					_M_reader_guard reader(*this);
 					return _M_max_height( _M_get_root() );
 				}
 				size_type min_height() const {
+					_M_reader_guard reader(*this);
 					return _M_min_height( _M_get_root() );
 				}
 			private:
-				link_const_type              _M_get_root() const { return const_cast<link_const_type>(_M_root); }
-				link_type                    _M_get_root()       { return _M_root; }
+				//Reusable buffers of traversals, every thread keeps its own ones between queries
+				struct _M_scratch_type {
+					std::vector<link_const_type>                          _M_current, _M_next, _M_inner, _M_stack;
+					std::vector< std::pair<link_const_type, size_type> > _M_levels;
+					std::vector<object_type>                              _M_temp;
+					std::vector< std::pair<distance_type, link_const_type> > _M_queue;
+				};
+				//Takes scratch buffers of the calling thread for the lifetime of the guard
+				//Nested traversals (e.g. _M_empty_branch during a query) take the next buffers of the thread
+				class _M_scratch_guard {
+					public:
+						_M_scratch_guard() : _M_scratch(nullptr) {
+							_M_pool_type& pool = _M_pool();
+							if ( pool.second == pool.first.size() ) pool.first.emplace_back( new _M_scratch_type() );
+							_M_scratch = pool.first[pool.second++].get();
+						}
+						~_M_scratch_guard() { --_M_pool().second; }
+						_M_scratch_type& operator* () const { return *_M_scratch; }
+						_M_scratch_type* operator->() const { return  _M_scratch; }
+					private:
+						_M_scratch_guard  (const _M_scratch_guard&);
+						_M_scratch_guard& operator=(const _M_scratch_guard&);
+						typedef std::pair< std::vector< std::unique_ptr<_M_scratch_type> >, size_type > _M_pool_type;
+						static _M_pool_type& _M_pool() { static thread_local _M_pool_type pool; return pool; }
+						_M_scratch_type* _M_scratch;
+				};
+				//Cached result of a query, it is valid while the generation of OCTree structure and generations of 
+				//branches of the root which the query overlaps (the root itself if it is a leaf node) do not change
+				struct _M_cache_entry {
+					_M_cache_entry() : _M_generation(0), _M_stamps(), _M_result() {}
+					size_type                                             _M_generation;
+					std::vector< std::pair<link_const_type, size_type> >  _M_stamps;
+					std::vector<object_type>                              _M_result;
+				};
+				typedef result_cache< std::vector<distance_type>, _M_cache_entry, sequence_hash<distance_type> > _M_cache_type;
+				//Looks a query up in the cache, on a miss stamps the branches for which overlaps(branch) is true into entry
+				//Stamps are taken before the query runs, so an insert which runs concurrently with it makes the result stale
+				template <class _Overlaps>
+					bool _M_cached(const std::vector<distance_type>& key, std::vector<object_type>& output, _M_cache_entry& entry, const _Overlaps& overlaps) const {
+						if ( _M_cache->find( key, entry, [this] (const _M_cache_entry& cached) { return _M_valid(cached); } ) ) {
+							output.swap(entry._M_result);
+							return true;
+						}
+						entry._M_generation = _M_generation;
+						link_const_type _Root = _M_get_root();
+						if ( _Root->isLeafNode() ) 
+							entry._M_stamps.push_back( std::make_pair(_Root, _Root->_M_generation.load()) );
+						else 
+							for (auto it_node = _Root->_M_child.begin(); it_node != _Root->_M_child.end(); ++it_node ) 
+								if ( overlaps(*it_node) ) entry._M_stamps.push_back( std::make_pair(*it_node, (*it_node)->_M_generation.load()) );
+						return false;
+					}
+				void _M_store(const std::vector<distance_type>& key, const std::vector<object_type>& output, _M_cache_entry& entry) const {
+					entry._M_result = output;
+					_M_cache->store(key, entry);
+				}
+				//Nodes of stamps are not removed while the generation of OCTree structure is the same
+				bool _M_valid(const _M_cache_entry& entry) const {
+					if ( entry._M_generation != _M_generation ) return false;
+					for (auto it_stamp = entry._M_stamps.begin(); it_stamp != entry._M_stamps.end(); ++it_stamp ) 
+						if ( it_stamp->first->_M_generation != it_stamp->second ) return false;
+					return true;
+				}
+				//Snaps bounds of a box outward to multiples of the quantum of the cache
+				box_type _M_snap(const box_type& box) const {
+					if ( !(_M_cache_quantum > 0) ) return box;
+					box_type result;
+					for ( size_t dim = 0; dim < __K; dim++ ) {
+						result._M_low_bounds [dim] = _M_clamp( std::floor( box._M_low_bounds [dim]/_M_cache_quantum )*_M_cache_quantum );
+						result._M_high_bounds[dim] = _M_clamp( std::ceil ( box._M_high_bounds[dim]/_M_cache_quantum )*_M_cache_quantum );
+					}
+					return result;
+				}
+				link_const_type              _M_get_root() const { return _M_root.load(); }
+				link_type                    _M_get_root()       { return _M_root.load(); }
 				size_type                    _M_height(link_const_type _Input) const     { 
 					size_type height = 1;
-					if (_Input->_M_parent == nullptr) 
-						return height;
-					else 
-						return height + _M_height( _Input->_M_parent ); 
+					for ( ; _Input->_M_parent != nullptr; _Input = _Input->_M_parent ) 
+						++height;
+					return height;
 				}
-				size_type                    _M_max_height(link_const_type _Input) const     { 
-					bool  _Input_isLeafNode = _Input->isLeafNode();
-					size_type height = 1;
-					if(!_Input_isLeafNode) {
-						typename node_type::node_const_iterator it_node;
-						typename node_type::node_const_iterator begin_node = _Input->_M_child.begin();
-						typename node_type::node_const_iterator end_node   = _Input->_M_child.end();
-						size_type temp = 0;
-						for(it_node = begin_node; it_node != end_node; ++it_node) temp = std::max(_M_max_height(*it_node), temp);
-						height += temp;
+				//Depth-first walk of OCTree structure by parent links, used by iterators
+				//Next node after a node, child nodes first, nullptr after the last node
+				static link_const_type _M_next_node(link_const_type _Node) {
+					if ( !_Node->isLeafNode() ) return _Node->_M_child.front();
+					return _M_next_branch(_Node);
+				}
+				//Next sibling of a node or of its closest ancestor which has one
+				static link_const_type _M_next_branch(link_const_type _Node) {
+					for ( link_const_type _Parent = _Node->_M_parent; _Parent != nullptr; _Node = _Parent, _Parent = _Parent->_M_parent ) {
+						auto it_node = std::find( _Parent->_M_child.begin(), _Parent->_M_child.end(), _Node );
+						if ( ++it_node != _Parent->_M_child.end() ) return *it_node;
+					}
+					return nullptr;
+				}
+				static link_const_type _M_first_leaf(link_const_type _Node) {
+					while ( _Node != nullptr && !_Node->isLeafNode() ) 
+						_Node = _Node->_M_child.front();
+					return _Node;
+				}
+				static link_const_type _M_next_leaf(link_const_type _Node) {
+					return _M_first_leaf( _M_next_branch(_Node) );
+				}
+				//Checks that a node stores the first copy of an object in strict mode: no leaf node before it in the depth-first
+				//order stores the object; an object is stored only in nodes which it overlaps, so only such earlier siblings
+				//of the nodes on the path from the root are searched, and only those for which filter(node) is true
+				static bool _M_owns(link_const_type _Node, object_const_reference __Object) {
+					return _M_owns(_Node, __Object, [] (link_const_type) { return true; });
+				}
+				template <class _Filter>
+					static bool _M_owns(link_const_type _Node, object_const_reference __Object, const _Filter& filter) {
+						for ( link_const_type _Parent = _Node->_M_parent; _Parent != nullptr; _Node = _Parent, _Parent = _Parent->_M_parent )
+							for ( auto it_node = _Parent->_M_child.begin(); *it_node != _Node; ++it_node )
+								if ( __Object( (*it_node)->_M_box ) && filter(*it_node) && _M_stores(*it_node, __Object, filter) ) return false;
+						return true;
 					}
+				//Checks that a branch stores an object in a node which the object overlaps, descending only into nodes
+				//for which filter(node) is true
+				template <class _Filter>
+					static bool _M_stores(link_const_type _Input, object_const_reference __Object, const _Filter& filter) {
+						_M_scratch_guard scratch;
+						std::vector<link_const_type>& stack = scratch->_M_stack;
+						stack.assign( 1, _Input );
+						while ( !stack.empty() ) {
+							link_const_type _Node = stack.back();
+							stack.pop_back();
+							for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data)
+								if ( !(*it_data < __Object) && !(__Object < *it_data) ) return true;
+							if ( _Node->isLeafNode() ) continue;
+							for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node )
+								if ( __Object( (*it_node)->_M_box ) && filter(*it_node) ) stack.push_back(*it_node);
+						}
+						return false;
+					}
+				//Visits all nodes of a branch by an explicit stack, visitor(node, height) gets heights relative to the branch
+				template <class _Visitor>
+					void                         _M_visit(link_const_type _Input, const _Visitor& visitor) const     { 
+						_M_scratch_guard scratch;
+						std::vector< std::pair<link_const_type, size_type> >& stack = scratch->_M_levels;
+						stack.clear();
+						stack.push_back( std::make_pair(_Input, size_type(1)) );
+						while ( !stack.empty() ) {
+							const std::pair<link_const_type, size_type> top = stack.back();
+							stack.pop_back();
+							visitor(top.first, top.second);
+							if ( !top.first->isLeafNode() ) 
+								for (auto it_node = top.first->_M_child.begin(); it_node != top.first->_M_child.end(); ++it_node ) 
+									stack.push_back( std::make_pair(*it_node, top.second + 1) );
+						}
+					}
+				size_type                    _M_max_height(link_const_type _Input) const     { 
+					size_type height = 0;
+					_M_visit(_Input, [&] (link_const_type _Node, size_type level) { if ( _Node->isLeafNode() ) height = std::max(height, level); } );
 					return height;		
 				}
 				size_type                    _M_min_height(link_const_type _Input) const     { 
-					bool  _Input_isLeafNode = _Input->isLeafNode();
-					size_type height = 1;
-					if(!_Input_isLeafNode) {
-						typename node_type::node_const_iterator it_node;
-						typename node_type::node_const_iterator begin_node = _Input->_M_child.begin();
-						typename node_type::node_const_iterator end_node   = _Input->_M_child.end();
-						size_type temp = std::numeric_limits<size_type>::max();
-						for(it_node = begin_node; it_node != end_node; ++it_node) temp = std::min(_M_min_height(*it_node), temp);
-						height += temp;
-					}
+					size_type height = std::numeric_limits<size_type>::max();
+					_M_visit(_Input, [&] (link_const_type _Node, size_type level) { if ( _Node->isLeafNode() ) height = std::min(height, level); } );
 					return height;		
 				}
 				size_type                    _M_size(link_const_type _Input) const     { 
-					bool  _Input_isLeafNode = _Input->isLeafNode();
-					size_type size = 1;
-					if(!_Input_isLeafNode) {
-						typename node_type::node_const_iterator it_node;
-						typename node_type::node_const_iterator begin_node = _Input->_M_child.begin();
-						typename node_type::node_const_iterator end_node   = _Input->_M_child.end();
-						for(it_node = begin_node; it_node != end_node; ++it_node) size += _M_size(*it_node);
-					}
+					size_type size = 0;
+					_M_visit(_Input, [&] (link_const_type, size_type) { ++size; } );
 					return size;		
 				}
+				//Operator has to be associative and commutative (std::plus, max, min), nodes are not visited in depth-first order
 				template <class Operator, class Functor>
 					size_type                    _M_size_if(link_const_type _Input,  Functor func) const     { 
 						Operator op;
 						size_type size = func(_Input);
-						bool  _Input_isLeafNode = _Input->isLeafNode();
-						if(!_Input_isLeafNode) {
-							typename node_type::node_const_iterator it_node;
-							typename node_type::node_const_iterator begin_node = _Input->_M_child.begin();
-							typename node_type::node_const_iterator end_node   = _Input->_M_child.end();
-							//for(it_node = begin_node; it_node != end_node; ++it_node) size += _M_size_if(*it_node, func);
-							for(it_node = begin_node; it_node != end_node; ++it_node) size = op(size, _M_size_if<Operator>(*it_node, func));
-						}
+						_M_visit(_Input, [&] (link_const_type _Node, size_type) { if ( _Node != _Input ) size = op(size, func(_Node)); } );
 						return size;		
 					}
 
-				std::vector<link_const_type> _M_find_nearest_s(const std::vector<link_const_type>& _Input, query_const_type& _M_query_point, value_const_type& _M_input_radius) {
-					typename std::vector<link_const_type>::const_iterator it_input;
-					typename std::vector<link_const_type>::const_iterator begin_input = _Input.begin();
-					typename std::vector<link_const_type>::const_iterator end_input   = _Input.end();
-
-					std::vector<link_const_type>    _Output;
-					bool  allOutputNodesAreLeafNodes = true;
-					value_type _M_output_radius = std::numeric_limits<double>::max();
-
-					for( it_input = begin_input; it_input != end_input; it_input++ ) {
-						const box_type& _Node_box = (*it_input)->_M_box;
-						//bool                 isLeafNode = (*it_input)->isLeafNode();
-						bool                isEmptyNode = _M_empty_branch(*it_input);
-						value_type         max_distance = _Node_box.longest_distance(_M_query_point) ;  
-						if (!isEmptyNode ) _M_output_radius = std::min(_M_output_radius, max_distance );			  
-					}
-					_M_output_radius = std::min(_M_output_radius, _M_input_radius);
-
-					for( it_input = begin_input; it_input != end_input; it_input++ ) {
-						const box_type& _Input_box = (*it_input)->_M_box;
-						bool  _Input_isLeafNode          = (*it_input)->isLeafNode();
-						bool  _Input_isEmptyNode         = _M_empty_branch(*it_input); 
-
-						if ( !_Input_isEmptyNode  ) {
-							_Sphere<__K, value_type> _box;
-							_box._M_center  = _M_query_point;
-							_box._M_radius2 = _M_output_radius;
-							//bool allPredicatesTrue = _Input_box.intersects_with(_box);
-							bool allPredicatesTrue = _box.intersects_with(_Input_box);
-							if(allPredicatesTrue) {
-								if ( _Input_isLeafNode ) {
-									_Output.push_back(*it_input);
-								} else {
-									typename node_type::node_const_iterator it_node;
-									typename node_type::node_const_iterator begin_node = (*it_input)->_M_child.begin();
-									typename node_type::node_const_iterator end_node   = (*it_input)->_M_child.end();
-									allOutputNodesAreLeafNodes = false;
-									_Output.insert( _Output.end(), begin_node, end_node );
+				//Traverse through OCTree structure level by level, the radius shrinks to the closest farthest corner of a frontier
+				//Leaf nodes are left in scratch._M_current, internal nodes which store objects themselves (loose mode) in scratch._M_inner
+				void _M_find_nearest_s(_M_scratch_type& scratch, query_const_type& _M_query_point, distance_type _M_output_radius) const {
+					typedef typename std::vector<link_const_type>::const_iterator input_iterator;
+
+					std::vector<link_const_type>& _Input  = scratch._M_current;
+					std::vector<link_const_type>& _Output = scratch._M_next;
+					std::vector<link_const_type>& _Inner  = scratch._M_inner;
+					_Input.clear(); _Inner.clear();
+					_Input.push_back( _M_get_root() );
+
+					bool  allOutputNodesAreLeafNodes = false;
+					while ( !allOutputNodesAreLeafNodes ) {
+						_M_output_radius = std::min(_M_output_radius, _M_frontier_radius(_Input, _M_query_point));
+						_Output.clear();
+						allOutputNodesAreLeafNodes = _M_expand_frontier( _Input, _Output, _Inner, 
+							[&] (input_iterator begin_input, input_iterator end_input, std::vector<link_const_type>& _Output, std::vector<link_const_type>& _Inner) {
+								return _M_find_nearest_s_level(begin_input, end_input, _M_query_point, _M_output_radius, _Output, _Inner);
+							} );
+						std::swap(_Input, _Output);
+					}
+				}
+				//Returns the shortest of the longest distances from a query point to non-empty nodes of a frontier
+				distance_type _M_frontier_radius(const std::vector<link_const_type>& _Input, query_const_type& _M_query_point) const {
+					auto radius_of = [&] (size_type begin, size_type end) {
+						distance_type radius = std::numeric_limits<distance_type>::max();
+						for ( size_type index = begin; index < end; ++index ) 
+							if ( !_M_empty_branch(_Input[index]) ) radius = std::min(radius, _Input[index]->_M_box.longest_distance(_M_query_point));
+						return radius;
+					};
+					const size_type chunks = _M_chunk_count( _Input.size() );
+					if ( chunks == 1 ) 
+						return radius_of(0, _Input.size());
+					std::vector<distance_type> radiuses( chunks, std::numeric_limits<distance_type>::max() );
+					_M_parallel_chunks( _Input.size(), chunks, [&] (size_type chunk, size_type begin, size_type end) {
+						radiuses[chunk] = radius_of(begin, end);
+					} );
+					return *std::min_element(radiuses.begin(), radiuses.end());
+				}
+				//Expands a part of a frontier of _M_find_nearest_s by one level
+				//Returns true if all output nodes are leaf nodes
+				template <class _Iterator>
+					bool _M_find_nearest_s_level(_Iterator begin_input, _Iterator end_input, query_const_type& _M_query_point, distance_const_type& _M_output_radius, std::vector<link_const_type>& _Output, std::vector<link_const_type>& _Inner) const {
+						_Iterator it_input;
+						bool  allOutputNodesAreLeafNodes = true;
+						for( it_input = begin_input; it_input != end_input; it_input++ ) {
+							const box_type& _Input_box = (*it_input)->_M_box;
+							bool  _Input_isLeafNode          = (*it_input)->isLeafNode();
+							bool  _Input_isEmptyNode         = _M_empty_branch(*it_input); 
+
+							if ( !_Input_isEmptyNode  ) {
+								_Sphere<__K, value_type> _box;
+								_box._M_center  = _M_query_point;
+								_box._M_radius2 = _M_output_radius;
+								//bool allPredicatesTrue = _Input_box.intersects_with(_box);
+								bool allPredicatesTrue = _box.intersects_with(_Input_box);
+								if(allPredicatesTrue) {
+									if ( _Input_isLeafNode ) {
+										_Output.push_back(*it_input);
+									} else {
+										typename node_type::node_const_iterator begin_node = (*it_input)->_M_child.begin();
+										typename node_type::node_const_iterator end_node   = (*it_input)->_M_child.end();
+										allOutputNodesAreLeafNodes = false;
+										if ( !(*it_input)->_M_data.empty() ) _Inner.push_back(*it_input);
+										_Output.insert( _Output.end(), begin_node, end_node );
+									}
 								}
+							} 
+						}
+						return allOutputNodesAreLeafNodes;
+					}
+				//Copies objects of found nodes (scratch._M_current and scratch._M_inner) into output
+				//Sorted data of an optimized OCTree is merged, so output is sorted as well
+				void _M_collect(_M_scratch_type& scratch, std::vector<object_type>& output) const {
+					std::vector<link_const_type>& _Input = scratch._M_current;
+					_Input.insert( _Input.end(), scratch._M_inner.begin(), scratch._M_inner.end() );
+					size_type size = 0;
+					for (auto it_result = _Input.begin(); it_result != _Input.end(); ++it_result) 
+						size += (*it_result)->_M_data.size();
+
+					output.clear();
+					output.reserve( size );
+					if ( !optimized ) {
+						for (auto it_result = _Input.begin(); it_result != _Input.end(); ++it_result) 
+							output.insert( output.end(), (*it_result)->_M_data.begin(), (*it_result)->_M_data.end() );
+						return;
+					}
+					//Data of an optimized OCTree is compacted into flat arrays
+					std::vector<object_type>& temp = scratch._M_temp;
+					temp.reserve( size );
+					for (auto it_result = _Input.begin(); it_result != _Input.end(); ++it_result) {
+						temp.clear();
+						std::merge(output.begin(), output.end(), (*it_result)->_M_data.flat_begin(), (*it_result)->_M_data.flat_end(), std::back_inserter(temp) );
+						std::swap(output, temp);
+					}
+					temp.clear();
+				}
+				//Number of chunks which a frontier of the given size is split into
+				size_type _M_chunk_count(size_type size) const {
+					if ( !_M_pool || size < 2*_M_chunk_size ) return 1;
+					return std::min<size_type>( _M_pool->size() + 1, size/_M_chunk_size );
+				}
+				//Runs task(chunk, begin, end) for each chunk of [0, size) on the query thread pool
+				//The first chunk is processed by the calling thread
+				template <class _Task>
+					void _M_parallel_chunks(size_type size, size_type chunks, const _Task& task) const {
+						if ( chunks == 1 ) {
+							task(0, 0, size);
+							return;
+						}
+						const size_type step = (size + chunks - 1)/chunks;
+						std::vector< std::future<void> > futures;
+						for ( size_type chunk = 1; chunk < chunks; ++chunk ) 
+							futures.push_back( _M_pool->submit( [&task, chunk, step, size] () {
+								task(chunk, std::min(size, chunk*step), std::min(size, (chunk + 1)*step));
+							} ) );
+						task(0, 0, std::min(size, step));
+						for ( auto it_future = futures.begin(); it_future != futures.end(); ++it_future ) 
+							it_future->get();
+					}
+				//Expands a frontier by one level, wide frontiers are split into chunks
+				//Outputs of chunks are concatenated in order, so the result does not depend on the number of chunks
+				template <class _Level>
+					bool _M_expand_frontier(const std::vector<link_const_type>& _Input, std::vector<link_const_type>& _Output, std::vector<link_const_type>& _Inner, const _Level& level) const {
+						const size_type chunks = _M_chunk_count( _Input.size() );
+						if ( chunks == 1 ) 
+							return level(_Input.begin(), _Input.end(), _Output, _Inner);
+
+						std::vector< std::vector<link_const_type> > outputs(chunks), inners(chunks);
+						std::vector<char>                           leaves (chunks);
+						_M_parallel_chunks( _Input.size(), chunks, [&] (size_type chunk, size_type begin, size_type end) {
+							leaves[chunk] = level(_Input.begin() + begin, _Input.begin() + end, outputs[chunk], inners[chunk]);
+						} );
+						bool allOutputNodesAreLeafNodes = true;
+						for ( size_type chunk = 0; chunk < chunks; ++chunk ) {
+							_Output.insert( _Output.end(), outputs[chunk].begin(), outputs[chunk].end() );
+							_Inner .insert( _Inner .end(), inners [chunk].begin(), inners [chunk].end() );
+							allOutputNodesAreLeafNodes &= leaves[chunk] != 0;
+						}
+						return allOutputNodesAreLeafNodes;
+					}
+				//Pair of branches of a join
+				//_M_self joins a branch with itself, _M_left_only/_M_right_only use objects of the node itself without its child nodes
+				struct _M_join_task {
+					_M_join_task(link_const_type node) : _M_left(node), _M_right(node), _M_self(true), _M_left_only(false), _M_right_only(false) {}
+					_M_join_task(link_const_type left, link_const_type right, bool left_only, bool right_only) 
+						: _M_left(left), _M_right(right), _M_self(false), _M_left_only(left_only), _M_right_only(right_only) {}
+					link_const_type _M_left, _M_right;
+					bool            _M_self, _M_left_only, _M_right_only;
+				};
+				//Replaces a task by tasks of the next level, returns false if the task cannot be split
+				bool _M_join_expand(const _M_join_task& task, std::vector<_M_join_task>& output) const {
+					link_const_type _Node = task._M_left;
+					if ( !task._M_self || task._M_left_only || _Node->isLeafNode() ) {
+						output.push_back(task);
+						return false;
+					}
+					_M_join_self_children( _Node, output );
+					return true;
+				}
+				void _M_join_self_children(link_const_type _Node, std::vector<_M_join_task>& output) const {
+					_M_join_task own(_Node);
+					own._M_left_only = own._M_right_only = true;
+					if ( !_Node->_M_data.empty() ) output.push_back(own);
+					for ( auto it_left = _Node->_M_child.begin(); it_left != _Node->_M_child.end(); ++it_left ) {
+						if ( !_Node->_M_data.empty() ) output.push_back( _M_join_task(_Node, *it_left, true, false) );
+						output.push_back( _M_join_task(*it_left) );
+						for ( auto it_right = it_left + 1; it_right != _Node->_M_child.end(); ++it_right ) 
+							output.push_back( _M_join_task(*it_left, *it_right, false, false) );
+					}
+				}
+				//Buffers of a worker of self_join, reused for all of its tasks
+				template <class _Pair>
+					struct _M_join_state {
+						std::vector<_M_join_task> _M_stack;
+						std::vector<_Pair>        _M_output;
+						std::vector<char>         _M_left, _M_right;
+					};
+				//Pairs found by a worker are passed to the callback once there are as many of them
+				static const size_type _M_join_batch = 1024;
+				//Traverse through OCTree structure by an explicit stack
+				//Descends into the larger of two branches until both are leaf nodes
+				template <class _Distance, class _Pair, class _Deliver>
+					void _M_join(const _M_join_task& _Task, distance_const_type radius2, const _Distance& distance, _M_join_state<_Pair>& state, const _Deliver& deliver) const {
+						std::vector<_M_join_task>& stack = state._M_stack;
+						stack.assign( 1, _Task );
+						while ( !stack.empty() ) {
+							const _M_join_task task = stack.back();
+							stack.pop_back();
+							link_const_type _Left  = task._M_left;
+							link_const_type _Right = task._M_right;
+							if ( _M_empty_branch(_Left) || _M_empty_branch(_Right) ) continue;
+							if ( task._M_self ) {
+								if ( task._M_left_only || _Left->isLeafNode() ) _M_join_nodes( _Left, _Left, radius2, distance, state, deliver );
+								else                                             _M_join_self_children( _Left, stack );
+								continue;
+							}
+							if ( _Left->_M_box.shortest_distance(_Right->_M_box) > radius2 ) continue;
+							const bool _Left_isLeafNode  = task._M_left_only  || _Left ->isLeafNode();
+							const bool _Right_isLeafNode = task._M_right_only || _Right->isLeafNode();
+							if ( _Left_isLeafNode && _Right_isLeafNode ) {
+								_M_join_nodes( _Left, _Right, radius2, distance, state, deliver );
+								continue;
 							}
-						} 
+							const bool split_left = !_Left_isLeafNode && ( _Right_isLeafNode || 
+								_Left->_M_box._M_high_bounds[0] - _Left->_M_box._M_low_bounds[0] >= _Right->_M_box._M_high_bounds[0] - _Right->_M_box._M_low_bounds[0] );
+							if ( split_left ) {
+								if ( !_Left->_M_data.empty() ) 
+									stack.push_back( _M_join_task(_Left, _Right, true, task._M_right_only) );
+								for ( auto it_node = _Left->_M_child.begin(); it_node != _Left->_M_child.end(); ++it_node ) 
+									stack.push_back( _M_join_task(*it_node, _Right, false, task._M_right_only) );
+							} else {
+								if ( !_Right->_M_data.empty() ) 
+									stack.push_back( _M_join_task(_Left, _Right, task._M_left_only, true) );
+								for ( auto it_node = _Right->_M_child.begin(); it_node != _Right->_M_child.end(); ++it_node ) 
+									stack.push_back( _M_join_task(_Left, *it_node, task._M_left_only, false) );
+							}
+						}
 					}
-					if (allOutputNodesAreLeafNodes) 
-						return _Output;
-					else 
-						return _M_find_nearest_s(_Output, _M_query_point, _M_output_radius );
+				//Pairs objects of two nodes (of one node with itself), each object only from the node which stores its first copy
+				//An object pair is then found in one pair of nodes, the nodes of the first copies of both objects
+				template <class _Distance, class _Pair, class _Deliver>
+					void _M_join_nodes(link_const_type _Left, link_const_type _Right, distance_const_type radius2, const _Distance& distance, _M_join_state<_Pair>& state, const _Deliver& deliver) const {
+						const bool self = _Left == _Right;
+						_M_owned_flags( _Left, state._M_left );
+						if ( !self ) _M_owned_flags( _Right, state._M_right );
+						const std::vector<char>& left  = state._M_left;
+						const std::vector<char>& right = self ? state._M_left : state._M_right;
+						auto it_left = _Left->_M_data.begin();
+						for ( size_type index = 0; index < left.size(); ++index, ++it_left ) {
+							if ( !left[index] ) continue;
+							auto it_right = self ? std::next(it_left) : _Right->_M_data.begin();
+							for ( size_type other = self ? index + 1 : 0; other < right.size(); ++other, ++it_right ) 
+								if ( right[other] ) _M_join_emit( *it_left, *it_right, radius2, distance, state._M_output );
+						}
+						if ( state._M_output.size() >= _M_join_batch ) deliver( state._M_output );
+					}
+				//Marks objects of a node which it stores the first copies of; objects appended meanwhile are left out
+				void _M_owned_flags(link_const_type _Node, std::vector<char>& flags) const {
+					flags.assign( _Node->_M_data.size(), 1 );
+					if ( _M_is_loose() || _Node->_M_objects == flags.size() ) return;
+					auto it_data = _Node->_M_data.begin();
+					for ( size_type index = 0; index < flags.size(); ++index, ++it_data ) 
+						flags[index] = _M_owns(_Node, *it_data) ? 1 : 0;
 				}
-				//Traverse through OCTree structure by recursion calls of itself
+				//Traverse through two OCTree structures by recursion calls of itself
+				//_Left_only/_Right_only use objects of the node itself without its child nodes
+				template <class _Other, class _Predicate, class _Pair>
+					void _M_dual_join(link_const_type _Left, bool _Left_only, const _Other* _Right, bool _Right_only, const _Predicate& predicate, std::vector<_Pair>& output) const {
+						if ( _Left->_M_count == 0 || _Right->_M_count == 0 ) return;
+						if ( !predicate(*_Left, *_Right) ) return;
+						const bool _Left_isLeafNode  = _Left_only  || _Left ->isLeafNode();
+						const bool _Right_isLeafNode = _Right_only || _Right->isLeafNode();
+						if ( _Left_isLeafNode && _Right_isLeafNode ) {
+							for ( auto it_left = _Left->_M_data.begin(); it_left != _Left->_M_data.end(); ++it_left ) 
+								for ( auto it_right = _Right->_M_data.begin(); it_right != _Right->_M_data.end(); ++it_right ) 
+									output.push_back( _Pair(*it_left, *it_right) );
+							return;
+						}
+						const bool split_left = !_Left_isLeafNode && ( _Right_isLeafNode || 
+							_Left->_M_box._M_high_bounds[0] - _Left->_M_box._M_low_bounds[0] >= _Right->_M_box._M_high_bounds[0] - _Right->_M_box._M_low_bounds[0] );
+						if ( split_left ) {
+							if ( !_Left->_M_data.empty() ) 
+								_M_dual_join( _Left, true, _Right, _Right_only, predicate, output );
+							for ( auto it_node = _Left->_M_child.begin(); it_node != _Left->_M_child.end(); ++it_node ) 
+								_M_dual_join( *it_node, false, _Right, _Right_only, predicate, output );
+						} else {
+							if ( !_Right->_M_data.empty() ) 
+								_M_dual_join( _Left, _Left_only, _Right, true, predicate, output );
+							for ( auto it_node = _Right->_M_child.begin(); it_node != _Right->_M_child.end(); ++it_node ) 
+								_M_dual_join( _Left, _Left_only, *it_node, false, predicate, output );
+						}
+					}
+				template <class _Distance, class _Pair>
+					void _M_join_emit(object_const_reference a, object_const_reference b, distance_const_type radius2, const _Distance& distance, std::vector<_Pair>& output) const {
+						if ( !(a < b) && !(b < a) ) return;
+						if ( distance(a, b) > radius2 ) return;
+						if ( a < b ) output.push_back( _Pair(a, b) );
+						else         output.push_back( _Pair(b, a) );
+					}
+				//Traverses through OCTree structure by an explicit stack
+				//Accumulates the kernel over branches which are far enough and over objects of opened nodes
+				template <class _Kernel>
+					void _M_evaluate(query_const_type& target, distance_const_type theta2, const _Kernel& kernel, typename _Kernel::result_type& result, std::vector<link_const_type>& stack) const {
+						stack.clear();
+						stack.push_back( _M_get_root() );
+						while ( !stack.empty() ) {
+							link_const_type _Node = stack.back(); stack.pop_back();
+							if ( _Node->_M_objects == 0 ) continue;
+
+							const aggregate_value_type  monopole = _Node->aggregateValue();
+							const query_type            center   = monopole.center();
+							distance_type size2 = 0, distance2 = 0;
+							for ( size_t dim = 0; dim < __K; dim++ ) {
+								distance_const_type size  = distance_type(_Node->_M_box._M_high_bounds[dim]) - _Node->_M_box._M_low_bounds[dim];
+								distance_const_type delta = distance_type(center[dim]) - target[dim];
+								size2     = std::max( size2, size*size );
+								distance2 += delta*delta;
+							}
+							if ( size2 < theta2*distance2 ) {
+								kernel( result, target, center, monopole.mass() );
+								continue;
+							}
+							//A body stored in several leaf nodes acts from the first of them only, as in the summaries
+							const bool owned = _M_is_loose() || _Node->_M_objects == _Node->_M_data.size();
+							for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data) {
+								if ( !owned && !_M_owns(_Node, *it_data) ) continue;
+								const aggregate_value_type body = aggregate_type::from_object(*it_data);
+								kernel( result, target, body.center(), body.mass() );
+							}
+							if ( !_Node->isLeafNode() ) 
+								for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) 
+									stack.push_back(*it_node);
+						}
+					}
+				//Counts objects of a node which are stored in no node before it for which filter(node) is true
+				//A leaf node whose objects are all first copies (see _M_owns) is counted without searching
+				template <class _Filter>
+					size_type _M_count_owned(link_const_type _Node, const _Filter& filter) const {
+						if ( _M_is_loose() || _Node->_M_objects == _Node->_M_data.size() ) return _Node->_M_data.size();
+						size_type count = 0;
+						for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data) 
+							if ( _M_owns(_Node, *it_data, filter) ) ++count;
+						return count;
+					}
+				//Counts objects of a node on the boundary of a region for _M_count_in, those for which exact is true if it is given
+				//Objects whose first copy is in a node inside of the region are counted by that node, the other ones at the first
+				//node on the boundary which stores them
+				template <class _Region, class _Exact, class _Keep>
+					size_type _M_count_boundary(link_const_type _Node, const _Region& region, _Exact exact, _Keep keep) const {
+						auto boundary = [&region] (link_const_type _Input) { return region.intersects_with(_Input->_M_box) && !region.contains(_Input->_M_box); };
+						const bool owned = _M_is_loose() || _Node->_M_objects == _Node->_M_data.size();
+						size_type count = 0;
+						for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data) {
+							if ( exact != nullptr && !(*exact)(*it_data) ) continue;
+							if ( keep  != nullptr && !(*keep) (*it_data) ) continue;
+							if ( owned || _M_owns(_Node, *it_data) ) {
+								++count;
+								continue;
+							}
+							link_const_type _First = _M_first_stored(_M_get_root(), *it_data);
+							if ( ( _First == nullptr || !region.contains(_First->_M_box) ) && _M_owns(_Node, *it_data, boundary) ) ++count;
+						}
+						return count;
+					}
+				//First node of a branch in the depth-first order which stores an object, nullptr if no node does
+				static link_const_type _M_first_stored(link_const_type _Input, object_const_reference __Object) {
+					_M_scratch_guard scratch;
+					std::vector<link_const_type>& stack = scratch->_M_stack;
+					stack.assign( 1, _Input );
+					while ( !stack.empty() ) {
+						link_const_type _Node = stack.back();
+						stack.pop_back();
+						if ( !__Object( _Node->_M_box ) ) continue;
+						for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data)
+							if ( !(*it_data < __Object) && !(__Object < *it_data) ) return _Node;
+						if ( !_Node->isLeafNode() ) 
+							stack.insert( stack.end(), _Node->_M_child.rbegin(), _Node->_M_child.rend() );
+					}
+					return nullptr;
+				}
+				//Number of copies of an object in the first node of a branch which stores it
+				static size_type _M_copies(link_const_type _Input, object_const_reference __Object) {
+					link_const_type _Node = _M_first_stored(_Input, __Object);
+					if ( _Node == nullptr ) return 0;
+					size_type count = 0;
+					for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data)
+						if ( !(*it_data < __Object) && !(__Object < *it_data) ) ++count;
+					return count;
+				}
+				//Counts first copies of objects of a branch for which keep is true
+				template <class _Keep>
+					size_type _M_count_kept(link_const_type _Input, const _Keep& keep) const {
+						size_type count = 0;
+						_M_visit( _Input, [&] (link_const_type _Node, size_type) {
+							const bool owned = _M_is_loose() || _Node->_M_objects == _Node->_M_data.size();
+							for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data)
+								if ( keep(*it_data) && ( owned || _M_owns(_Node, *it_data) ) ) ++count;
+						} );
+						return count;
+					}
+				//Traverse through OCTree structure by an explicit stack
+				//Counts objects of a branch which intersects a region
+				//Objects for which keep is false are not counted if it is given, nodes inside of the region are then walked
+				//object by object instead of being added up by their counters
+				template <class _Region, class _Exact, class _Keep>
+					size_type _M_count_in(link_const_type _Input, const _Region& region, _Exact exact, _Keep keep) const {
+						_M_scratch_guard scratch;
+						std::vector<link_const_type>& stack = scratch->_M_stack;
+						stack.clear();
+						stack.push_back(_Input);
+
+						size_type count = 0;
+						while ( !stack.empty() ) {
+							link_const_type _Node = stack.back();
+							stack.pop_back();
+							if ( !region.intersects_with(_Node->_M_box) || _M_empty_branch(_Node) ) continue;
+							if ( region.contains(_Node->_M_box) ) {
+								count += keep == nullptr ? size_type(_Node->_M_objects) : _M_count_kept(_Node, *keep);
+								continue;
+							}
+							count += _M_count_boundary(_Node, region, exact, keep);
+							if ( !_Node->isLeafNode() ) 
+								stack.insert( stack.end(), _Node->_M_child.begin(), _Node->_M_child.end() );
+						}
+						return count;
+					}
+				//Traverse through OCTree structure level by level
 				//Checks that an OCTree node is intersected with all predicates
-				//Returns leaf nodes
+				//Leaf nodes are left in scratch._M_current, internal nodes which store objects themselves (loose mode) in scratch._M_inner
 				template<class Functor> 
-					std::vector<link_const_type> _M_find_if(const  std::vector<link_const_type>& _Input, const Functor& functor) {
-						typename std::vector<link_const_type>::const_iterator it_input;
-						typename std::vector<link_const_type>::const_iterator begin_input = _Input.begin();
-						typename std::vector<link_const_type>::const_iterator end_input   = _Input.end();
+					void _M_find_if(_M_scratch_type& scratch, const Functor& functor) const {
+						typedef typename std::vector<link_const_type>::const_iterator input_iterator;
 
-						std::vector<link_const_type>    _Output;
+						std::vector<link_const_type>& _Input  = scratch._M_current;
+						std::vector<link_const_type>& _Output = scratch._M_next;
+						std::vector<link_const_type>& _Inner  = scratch._M_inner;
+						_Input.clear(); _Inner.clear();
+						_Input.push_back( _M_get_root() );
+
+						bool  allOutputNodesAreLeafNodes = false;
+						while ( !allOutputNodesAreLeafNodes ) {
+							_Output.clear();
+							allOutputNodesAreLeafNodes = _M_expand_frontier( _Input, _Output, _Inner, 
+								[&] (input_iterator begin_input, input_iterator end_input, std::vector<link_const_type>& _Output, std::vector<link_const_type>& _Inner) {
+									return _M_find_if_level(begin_input, end_input, functor, _Output, _Inner);
+								} );
+							std::swap(_Input, _Output);
+						}
+					}
+				//Expands a part of a frontier of _M_find_if by one level
+				//Returns true if all output nodes are leaf nodes
+				template<class _Iterator, class Functor> 
+					bool _M_find_if_level(_Iterator begin_input, _Iterator end_input, const Functor& functor, std::vector<link_const_type>& _Output, std::vector<link_const_type>& _Inner) const {
+						_Iterator it_input;
 						bool  allOutputNodesAreLeafNodes = true;
 
 						for( it_input = begin_input; it_input != end_input; it_input++ ) {
@@ -433,174 +1616,891 @@ template <typename type> struct max {
 									if ( _Input_isLeafNode ) {
 										_Output.push_back(*it_input);
 									} else {
-										typename node_type::node_const_iterator it_node;
 										typename node_type::node_const_iterator begin_node = (*it_input)->_M_child.begin();
 										typename node_type::node_const_iterator end_node   = (*it_input)->_M_child.end();
 										allOutputNodesAreLeafNodes = false;
+										if ( !(*it_input)->_M_data.empty() ) _Inner.push_back(*it_input);
 										_Output.insert( _Output.end(), begin_node, end_node );
 									}
 								}
 							} 
 						}
-						if (allOutputNodesAreLeafNodes) 
-							return _Output;
-						else 
-							return _M_find_if( _Output, functor);
+						return allOutputNodesAreLeafNodes;
 					}
-				//Traverse through OCTree structure by recursion calls of itself
-				//Checks that an query point is inside of an OCTree node 
+				//Traverse through OCTree structure by descending into the closest non-empty child node
+				//An internal node which stores objects itself (loose mode) is the answer if its branch has nothing closer
 				//Returns leaf node
-				link_const_type _M_find_nearest(link_const_type _Node, query_const_type& point, value_const_type& radius) {
+				link_const_type _M_find_nearest(link_const_type _Node, query_const_type& point, distance_const_type& radius) const {
+					link_const_type _Fallback = nullptr;
+					link_const_type _Leaf     = nullptr;
+					while ( _Node != nullptr ) 
+						_Node = _M_find_nearest_step(_Node, point, radius, _Fallback, _Leaf);
+					return _Leaf;
+				}
+				//Descends by one level of _M_find_nearest, returns the next node or nullptr if the descent ends
+				//The found node (a leaf node or the last non-empty internal node on the way) is written into _Leaf
+				link_const_type _M_find_nearest_step(link_const_type _Node, query_const_type& point, distance_const_type& radius, link_const_type& _Fallback, link_const_type& _Leaf) const {
 					link_const_type _ClosestNode = nullptr;
-					value_type   shortest_radius = std::numeric_limits<value_type>::max();
+					distance_type shortest_radius = std::numeric_limits<distance_type>::max();
 					typename node_const_type::node_const_iterator it_node;
 					typename node_const_type::node_const_iterator begin_node = _Node->_M_child.begin();
 					typename node_const_type::node_const_iterator end_node   = _Node->_M_child.end();
 					for ( it_node = begin_node; it_node != end_node; it_node++ ) {
 						if(!_M_empty_branch(*it_node)) {
-							value_type temp = (*it_node)->_M_box.shortest_distance(point);
+							distance_type temp = (*it_node)->_M_box.shortest_distance(point);
 							if(temp < shortest_radius) {
 								shortest_radius = temp;
 								_ClosestNode = (*it_node);
 							}
 						}
 					}
-					if( shortest_radius < radius ) 
-						if(_ClosestNode->isLeafNode() ) {
-							_M_empty_branch(_ClosestNode);
-							return _ClosestNode;
+					if( !(shortest_radius < radius) ) { _Leaf = _Fallback; return nullptr; }
+					if( _ClosestNode->isLeafNode() ) { _Leaf = _ClosestNode; return nullptr; }
+					if( !_ClosestNode->_M_data.empty() ) _Fallback = _ClosestNode;
+					return _ClosestNode;
+				}
+				//Objects of a node found by find_nearest
+				std::vector<object_type> _M_nearest_objects(link_const_type _Node) const {
+					std::vector<object_type> output( _Node->_M_data.begin(), _Node->_M_data.end() );
+					if ( !_M_is_loose() ) return output;
+					//Objects of the ancestors can also be close to the query point in loose mode
+					for ( link_const_type _Parent = _Node->_M_parent; _Parent != nullptr; _Parent = _Parent->_M_parent ) 
+						output.insert( output.end(), _Parent->_M_data.begin(), _Parent->_M_data.end() );
+					return output;
+				}
+				//Runs descents of queries in groups, step(node, point, fallback, leaf) descends a query by one level
+				//A query takes its turn when the child nodes which it has to test were prefetched during the turns of 
+				//the other queries of the group; found nodes are written into leaves
+				template <class _Step>
+					void _M_find_group(const std::vector<query_type>& points, size_t group, std::vector<link_const_type>& leaves, const _Step& step) const {
+						group = std::max<size_t>( 1, group );
+						leaves.assign( points.size(), nullptr );
+						std::vector<link_const_type> nodes, fallbacks;
+						for ( size_type begin = 0; begin < points.size(); begin += group ) {
+							const size_type end = std::min<size_type>( points.size(), begin + group );
+							nodes    .assign( end - begin, _M_get_root() );
+							fallbacks.assign( end - begin, nullptr );
+							_M_prefetch_children( _M_get_root() );
+							for ( size_type active = end - begin; active != 0; ) {
+								active = 0;
+								for ( size_type index = begin; index < end; ++index ) {
+									link_const_type& _Node = nodes[index - begin];
+									if ( _Node == nullptr ) continue;
+									_Node = step( _Node, points[index], fallbacks[index - begin], leaves[index] );
+									if ( _Node != nullptr ) {
+										_M_prefetch_children(_Node);
+										++active;
+									} else if ( leaves[index] != nullptr ) 
+										_M_prefetch( leaves[index]->_M_data.flat_begin() );
+								}
+							}
+						}
+					}
+				//Hints the processor to load child nodes of a node into the cache, a descent tests their states, objects and boxes
+				static void _M_prefetch_children(link_const_type _Node) {
+					for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) 
+						if ( *it_node != nullptr ) {
+							_M_prefetch( *it_node );
+							_M_prefetch( &(*it_node)->_M_data );
+							_M_prefetch( &(*it_node)->_M_box );
 						}
-						else return _M_find_nearest( _ClosestNode, point, radius);
-					else return nullptr;
 				}
-				//Traverse through OCTree structure by recursion calls of itself
-				//Checks that an query point is inside of an OCTree node 
+				static void _M_prefetch(const void* address) {
+#ifdef __GNUC__
+					__builtin_prefetch(address);
+#else
+					(void)address;
+#endif
+				}
+				//Traverse through OCTree structure by a priority queue of nodes ordered by their squared distances to a query point
+				//Stops when the closest queued node is farther than scale times the best distance found so far
+				template <class _Distance>
+					void _M_find_nearest_object(_M_scratch_type& scratch, query_const_type& point, const _Distance& distance, distance_const_type scale, std::vector< std::pair<object_type, distance_type> >& output) const {
+						typedef std::pair<distance_type, link_const_type> queue_entry;
+						auto farther = [] (const queue_entry& a, const queue_entry& b) { return a.first > b.first; };
+
+						std::vector<queue_entry>& queue = scratch._M_queue;
+						queue.clear();
+						queue.push_back( queue_entry(_M_get_root()->_M_box.shortest_distance(point), _M_get_root()) );
+						while ( !queue.empty() ) {
+							std::pop_heap( queue.begin(), queue.end(), farther );
+							const queue_entry top = queue.back();
+							queue.pop_back();
+							if ( !output.empty() && top.first > scale*output[0].second ) break;
+
+							link_const_type _Node = top.second;
+							for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data) {
+								const distance_type distance2 = distance(*it_data, point);
+								if ( output.empty() ) 
+									output.push_back( std::make_pair(*it_data, distance2) );
+								else if ( distance2 < output[0].second || ( !(output[0].second < distance2) && *it_data < output[0].first ) ) 
+									output[0] = std::make_pair(*it_data, distance2);
+							}
+							if ( _Node->isLeafNode() ) continue;
+							for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) {
+								if ( _M_empty_branch(*it_node) ) continue;
+								const distance_type bound = (*it_node)->_M_box.shortest_distance(point);
+								if ( !output.empty() && bound > scale*output[0].second ) continue;
+								queue.push_back( queue_entry(bound, *it_node) );
+								std::push_heap( queue.begin(), queue.end(), farther );
+							}
+						}
+					}
+				//Traverse through OCTree structure by an explicit stack, the second member of an entry marks branches inside of the sphere
+				template <class _Distance>
+					void _M_find_within(_M_scratch_type& scratch, query_const_type& point, distance_const_type radius2, const _Distance& distance, std::vector< std::pair<object_type, distance_type> >& output) const {
+						_Sphere<__K, value_type> sphere;
+						sphere._M_center  = point;
+						sphere._M_radius2 = radius2;
+						const _SphereFunctor<__K, value_type> functor(sphere);
+
+						std::vector< std::pair<link_const_type, size_type> >& stack = scratch._M_levels;
+						stack.clear();
+						stack.push_back( std::make_pair(_M_get_root(), size_type(0)) );
+						while ( !stack.empty() ) {
+							const std::pair<link_const_type, size_type> top = stack.back();
+							stack.pop_back();
+							link_const_type _Node = top.first;
+							bool          isInside = top.second != 0;
+							if ( !isInside ) {
+								if ( !functor(*_Node) || _M_empty_branch(_Node) ) continue;
+								isInside = sphere.contains(_Node->_M_box);
+							}
+							for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data) {
+								const distance_type distance2 = distance(*it_data, point);
+								if ( isInside || distance2 <= radius2 ) output.push_back( std::make_pair(*it_data, distance2) );
+							}
+							if ( !_Node->isLeafNode() ) 
+								for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) 
+									stack.push_back( std::make_pair(*it_node, size_type(isInside ? 1 : 0)) );
+						}
+					}
+				//Traverse through OCTree structure by descending into the child node which contains a query point
 				//Returns leaf node
-				link_const_type _M_find_exact(link_const_type _Node, query_const_type& point) {
+				link_const_type _M_find_exact(link_const_type _Node, query_const_type& point) const {
+					link_const_type _Leaf = nullptr;
+					while ( _Node != nullptr ) 
+						_Node = _M_find_exact_step(_Node, point, _Leaf);
+					return _Leaf;
+				}
+				//Descends by one level of _M_find_exact, returns the next node or nullptr if the descent ends
+				//The leaf node which contains the query point is written into _Leaf
+				link_const_type _M_find_exact_step(link_const_type _Node, query_const_type& point, link_const_type& _Leaf) const {
 					typename node_const_type::node_const_iterator it_node;
 					typename node_const_type::node_const_iterator begin_node = _Node->_M_child.begin();
 					typename node_const_type::node_const_iterator end_node   = _Node->_M_child.end();
 					for ( it_node = begin_node; it_node != end_node; it_node++ ) {
 						if(!_M_empty_branch(*it_node)) {
 							if( (*it_node)->_M_box.is_inside(point) ) {
-								if( (*it_node)->isLeafNode() ) return                  (*it_node);
-								else                           return _M_find_exact( (*it_node), point);
+								if( (*it_node)->isLeafNode() ) { _Leaf = (*it_node); return nullptr; }
+								return (*it_node);
 							}
 						}
 					}
 					return nullptr;
 				}
+				//Climbs from a cursor node by parent links until a query point is inside of a non-empty node
+				//Descends from that node as _M_find_exact does, falls back to the root if nothing is found
+				//Returns leaf node
+				link_const_type _M_find_exact(const cursor_type& cursor, query_const_type& point) {
+					link_const_type _Node = cursor._M_node;
+					if ( _Node == nullptr || cursor._M_revision != _M_revision ) 
+						return _M_find_exact(_M_get_root(), point);
+					while ( _Node->_M_parent != nullptr && !( _Node->_M_box.is_inside(point) && !_M_empty_branch(_Node) ) ) 
+						_Node = _Node->_M_parent;
+					if ( _Node->_M_parent == nullptr ) 
+						return _M_find_exact(_Node, point);
+					if ( _Node->isLeafNode() ) 
+						return _Node;
+					link_const_type _Leaf = _M_find_exact(_Node, point);
+					return _Leaf != nullptr ? _Leaf : _M_find_exact(_M_get_root(), point);
+				}
 				//Optimizes OCTree structure
-				void _M_pre_optimize ( link_type _Node ) {
+				//Marks leaf nodes to split and branches of empty leaf nodes to clear, child nodes before their parents
+				void _M_pre_optimize ( link_type _Root ) {
 						size_type        threshold      =  50;
 						size_type        maximal_height =  10;
-						auto             expected = node_type::STATE::M_DEFAULT;
-						auto			 val      = node_type::STATE::M_NO_ACTION;
-
-						if ( _Node->isLeafNode() ) {
-							if ( _Node->_M_state.compare_exchange_strong( expected, val ) ) {
-								size_type        currentSize = _Node->_M_data.size();
-								if( currentSize > threshold && _M_height(_Node) < maximal_height ) 
-									_Node->_M_state = node_type::STATE::M_SPLIT_NODE;
-								if(currentSize == 0) { 
-									_Node->_M_state = node_type::STATE::M_EMPTY_NODE;
+						std::vector<link_type> nodes;
+						_M_visit( _Root, [&nodes] (link_const_type _Node, size_type) { nodes.push_back( const_cast<link_type>(_Node) ); } );
+						for ( auto it = nodes.rbegin(); it != nodes.rend(); ++it ) {
+							link_type        _Node    = *it;
+							auto             expected = node_type::STATE::M_DEFAULT;
+							auto			 val      = node_type::STATE::M_NO_ACTION;
+							if ( _Node->isLeafNode() ) {
+								if ( _Node->_M_state.compare_exchange_strong( expected, val ) ) {
+									size_type        currentSize = _Node->_M_data.size();
+									if( currentSize > threshold && _M_height(_Node) < maximal_height ) 
+										_Node->_M_state = node_type::STATE::M_SPLIT_NODE;
+									if(currentSize == 0) { 
+										_Node->_M_state = node_type::STATE::M_EMPTY_NODE;
+									}
+								}
+							} else {
+								bool  clear_branch_flag = true;
+								for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) 
+						  	 	 	clear_branch_flag &= 
+										( (*it_node)->_M_state == node_type::STATE::M_CLEAR_BRANCH && (*it_node)->_M_data.empty() )
+										||
+										(*it_node)->_M_state == node_type::STATE::M_EMPTY_NODE;
+								if( clear_branch_flag ) {
+									_Node->_M_state = node_type::STATE::M_CLEAR_BRANCH;
 								}
-							}
-						} else {
-							for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) {
-								_M_pre_optimize(*it_node);
-							}
-							bool  clear_branch_flag = true;
-							for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) 
-					  	 	 	clear_branch_flag &= 
-									(*it_node)->_M_state == node_type::STATE::M_CLEAR_BRANCH
-									||
-									(*it_node)->_M_state == node_type::STATE::M_EMPTY_NODE;
-							if( clear_branch_flag ) {
-								_Node->_M_state = node_type::STATE::M_CLEAR_BRANCH;
 							}
 						}
 					return;
 				}
-				void _M_optimize     ( link_type _Node  ) {
-						if ( _Node->_M_state == node_type::STATE::M_DEFAULT ) {
-							for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node )
-								_M_optimize(*it_node);
-						} else {
+				//Clears and splits marked nodes by an explicit stack, child nodes of a split node are split further if worthy
+				void _M_optimize     ( link_type _Root  ) {
+						std::vector<link_type> stack( 1, _Root );
+						while ( !stack.empty() ) {
+							link_type _Node = stack.back();
+							stack.pop_back();
+							if ( _Node->_M_state == node_type::STATE::M_DEFAULT ) {
+								for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node )
+									if ( *it_node != nullptr ) stack.push_back(*it_node);
+								continue;
+							}
 							auto state = _Node->_M_state.exchange( node_type::STATE::M_NO_ACTION );
 							//Clear branch
 							if ( state == node_type::STATE::M_CLEAR_BRANCH ) {
-								for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) {
+								const auto child = _Node->_M_child;
+								std::array<link_type, power<__K>::result> none;
+								std::fill( none.begin(), none.end(), nullptr );
+								_Node->setChildren(none);
+								for (auto it_node = child.begin(); it_node != child.end(); ++it_node ) 
 									_M_remove_node(*it_node);
-									*it_node = nullptr;
-								}
 							}
 						 	//Split leaf node	
 							if ( state == node_type::STATE::M_SPLIT_NODE ) {
-								size_type        threshold      =  50;
-								size_type        maximal_height =  10;
-								value_const_type factor = std::sqrt(static_cast<value_type>(power<__K>::result));
 								size_type        currentSize = _Node->_M_data.size();
-								//Create child nodes		  
-								_Node->_M_child = _M_create_nodes( _Node );
-								for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data)
-									_M_insert(_Node, (*it_data) );
-								//Clear node
-								_Node->clearData();
+								_M_split(_Node);
 								for (auto it_child = _Node->_M_child.begin(); it_child != _Node->_M_child.end(); ++it_child) {
-									const size_t newSize = (*it_child)->_M_data.size();
-									if(currentSize > factor*newSize &&  newSize > threshold && _M_height(*it_child) < maximal_height ) 
+									if( _M_split_worthy(currentSize, *it_child) ) 
 							    		(*it_child)->_M_state = node_type::STATE::M_SPLIT_NODE;	
 									else
 										(*it_child)->_M_state = node_type::STATE::M_NO_ACTION;
-									_M_optimize(*it_child);
+									stack.push_back(*it_child);
 								}
 							}
 						}
 					return;
 				}
-				void _M_post_optimize( link_type _Node ) {
-					if (_Node->isLeafNode()) {
-						auto state = _Node->_M_state.exchange(node_type::STATE::M_DEFAULT);
-						if (state == node_type::STATE::M_NO_ACTION)
-							_Node->sortData();
-					} else
-						for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node )
-							_M_post_optimize(*it_node);
-					return;
+				//Creates child nodes of a leaf node and moves its objects into them
+				//Objects which fit no child node return to the node in loose mode
+				void _M_split( link_type _Node ) {
+					_Node->setChildren( _M_create_nodes( _Node ) );
+					std::vector<__Val> _Data;
+					_Node->swapData(_Data);
+					for (auto it_data = _Data.begin(); it_data != _Data.end(); ++it_data)
+						if ( _M_is_loose() ) _M_insert_loose(_Node, (*it_data) );
+						else                 _M_insert      (_Node, (*it_data) );
+				}
+				//Checks that a child node of a split node which kept currentSize objects is worth splitting as well
+				bool _M_split_worthy( size_type currentSize, link_const_type _Child ) const {
+					size_type        threshold      =  50;
+					size_type        maximal_height =  10;
+					distance_const_type factor = std::sqrt(static_cast<distance_type>(power<__K>::result));
+					const size_t newSize = _Child->_M_data.size();
+					return currentSize > factor*newSize &&  newSize > threshold && _M_height(_Child) < maximal_height;
+				}
+				//Optimizes OCTree structure within the memory budget, runs after _M_pre_optimize
+				//Leaves marked for splitting are split by a priority queue, the densest leaf first, as long as
+				//the bytes of a split fit into the budget; children of a split leaf are queued by the usual split rules
+				void _M_optimize_budget( link_type _Root ) {
+					typedef std::pair<size_type, link_type> entry_type;
+					auto sparser = [] (const entry_type& a, const entry_type& b) { return a.first < b.first; };
+					std::vector<entry_type> queue;
+					//Marks of _M_pre_optimize are taken over by the queue, so _M_optimize clears branches only
+					//Objects are moved into flat arrays, so spare capacity of segments is not charged to the budget
+					std::vector<link_type> stack( 1, _Root );
+					while ( !stack.empty() ) {
+						link_type _Node = stack.back(); stack.pop_back();
+						_Node->_M_data.compact();
+						if ( _Node->_M_state == node_type::STATE::M_SPLIT_NODE ) {
+							_Node->_M_state = node_type::STATE::M_NO_ACTION;
+							queue.push_back( entry_type(_Node->_M_data.size(), _Node) );
+						}
+						if ( _Node->_M_state != node_type::STATE::M_DEFAULT ) continue;
+						for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) 
+							if ( *it_node != nullptr ) stack.push_back(*it_node);
+					}
+					_M_optimize(_Root);
+					std::make_heap( queue.begin(), queue.end(), sparser );
+
+					size_type       used  = _M_size_if< std::plus<size_type> >( _Root, size_of_all );
+					const size_type nodes = power<__K>::result*sizeof(node_type);
+					while ( !queue.empty() && used + nodes <= _M_memory_budget ) {
+						std::pop_heap( queue.begin(), queue.end(), sparser );
+						link_type _Node = queue.back().second;
+						queue.pop_back();
+						const size_type currentSize = _Node->_M_data.size();
+						used -= size_of_all(_Node);
+						_M_split(_Node);
+						_Node->_M_data.compact();
+						used += size_of_all(_Node);
+						for (auto it_child = _Node->_M_child.begin(); it_child != _Node->_M_child.end(); ++it_child) {
+							(*it_child)->_M_data.compact();
+							used += size_of_all(*it_child);
+							(*it_child)->_M_state = node_type::STATE::M_NO_ACTION;
+							if ( _M_split_worthy(currentSize, *it_child) ) {
+								queue.push_back( entry_type((*it_child)->_M_data.size(), *it_child) );
+								std::push_heap( queue.begin(), queue.end(), sparser );
+							}
+						}
+					}
+					if ( used > _M_memory_budget ) 
+						_M_collapse_budget(_Root, used);
+				}
+				//Merges child leaves of internal nodes into them, the branch with the fewest objects first,
+				//until the tree fits into the memory budget or only the root is left
+				void _M_collapse_budget( link_type _Root, size_type used ) {
+					typedef std::pair<size_type, link_type> entry_type;
+					auto denser = [] (const entry_type& a, const entry_type& b) { return a.first > b.first; };
+					//Objects of a node and its child nodes, the number of objects of a branch of leaves
+					auto objects_of = [] (link_const_type _Node) {
+						size_type count = _Node->_M_data.size();
+						for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) 
+							count += (*it_node)->_M_data.size();
+						return count;
+					};
+					auto collapsible = [] (link_const_type _Node) {
+						if ( _Node->isLeafNode() ) return false;
+						for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) 
+							if ( *it_node == nullptr || !(*it_node)->isLeafNode() ) return false;
+						return true;
+					};
+					std::vector<entry_type> queue;
+					_M_visit( _Root, [&] (link_const_type _Node, size_type) { 
+						if ( collapsible(_Node) ) queue.push_back( entry_type(objects_of(_Node), const_cast<link_type>(_Node)) );
+					} );
+					std::make_heap( queue.begin(), queue.end(), denser );
+					while ( !queue.empty() && used > _M_memory_budget ) {
+						std::pop_heap( queue.begin(), queue.end(), denser );
+						link_type _Node = queue.back().second;
+						queue.pop_back();
+						//Strict mode stores an object in every leaf which it overlaps, such copies are merged
+						std::vector<__Val> _Data( _Node->_M_data.begin(), _Node->_M_data.end() );
+						used -= size_of_all(_Node);
+						const auto child = _Node->_M_child;
+						std::array<link_type, power<__K>::result> none;
+						std::fill( none.begin(), none.end(), nullptr );
+						_Node->setChildren(none);
+						for (auto it_node = child.begin(); it_node != child.end(); ++it_node ) {
+							_Data.insert( _Data.end(), (*it_node)->_M_data.begin(), (*it_node)->_M_data.end() );
+							used -= size_of_all(*it_node);
+							delete *it_node;
+						}
+						std::sort( _Data.begin(), _Data.end() );
+						_Data.erase( std::unique( _Data.begin(), _Data.end(), [] (object_const_reference a, object_const_reference b) { 
+							return !(a < b) && !(b < a); 
+						} ), _Data.end() );
+						_Node->swapData(_Data);
+						_Node->_M_state = node_type::STATE::M_NO_ACTION;
+						used += size_of_all(_Node);
+						link_type _Parent = _Node->_M_parent;
+						if ( _Parent != nullptr && collapsible(_Parent) ) {
+							queue.push_back( entry_type(objects_of(_Parent), _Parent) );
+							std::push_heap( queue.begin(), queue.end(), denser );
+						}
+					}
+				}
+				//Objects are sorted before counters and summaries are rebuilt, since a leaf node looks for copies of its 
+				//objects in the leaf nodes before it
+				void _M_post_optimize( link_type _Root ) {
+					_M_sort_data(_Root);
+					_M_summarize_branch(_Root);
+				}
+				//Resets states of a branch and sorts objects of its nodes
+				void _M_sort_data( link_type _Root ) {
+					_M_visit( _Root, [] (link_const_type _Input, size_type) {
+						link_type _Node = const_cast<link_type>(_Input);
+						if (_Node->isLeafNode()) {
+							auto state = _Node->_M_state.exchange(node_type::STATE::M_DEFAULT);
+							if (state == node_type::STATE::M_NO_ACTION)
+								_Node->sortData();
+						} else {
+							//Split leaf nodes keep their state, so the next optimization descends into them
+							_Node->_M_state = node_type::STATE::M_DEFAULT;
+							//Internal nodes store objects in loose mode
+							if (!_Node->_M_data.empty())
+								_Node->sortData();
+						}
+					} );
+				}
+				//Rebuilds counters and summaries of a branch bottom-up
+				void _M_summarize_branch( link_type _Root ) {
+					std::vector<link_type> nodes;
+					_M_visit( _Root, [&] (link_const_type _Node, size_type) { nodes.push_back( const_cast<link_type>(_Node) ); } );
+					//Child nodes follow their parents in the visiting order
+					for ( auto it_node = nodes.rbegin(); it_node != nodes.rend(); ++it_node ) 
+						_M_summarize(*it_node);
+				}
+				//Rebuilds the counter and the summary of a node from its own objects and its child nodes
+				//Split nodes distribute objects among several child nodes, so counters and summaries are rebuilt
+				void _M_summarize( link_type _Node ) {
+					size_type            count   = _Node->_M_data.size();
+					size_type            objects = 0;
+					aggregate_value_type value   = aggregate_type::identity();
+					for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data) 
+						if ( _M_is_loose() || _M_owns(_Node, *it_data) ) {
+							++objects;
+							value = aggregate_type::combine( value, aggregate_type::from_object(*it_data) );
+						}
+					if ( !_Node->isLeafNode() ) 
+						for (auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) {
+							count   += (*it_node)->_M_count;
+							objects += (*it_node)->_M_objects;
+							value    = aggregate_type::combine( value, (*it_node)->_M_aggregate );
+						}
+					_Node->_M_count     = count;
+					_Node->_M_objects   = objects;
+					_Node->_M_aggregate = value;
 				}
 				//Checks that a branch is empty or not
 				bool _M_empty_branch( link_const_type _Node ) const {
 					if(_Node->isLeafNode()) {
 						return _Node->_M_data.empty();
 					} else {
+						if ( !_Node->_M_data.empty() ) return false;
 						if ( optimized ) {
 							for (auto it = _Node->_M_child.begin(); it != _Node->_M_child.end(); ++it ) 
 								if( (*it) != nullptr ) return false;
+							return true;
 						}
-						else {
-							for (auto it = _Node->_M_child.begin(); it != _Node->_M_child.end(); ++it ) 
-								if( !_M_empty_branch(*it) ) return false;
+						_M_scratch_guard scratch;
+						std::vector<link_const_type>& stack = scratch->_M_stack;
+						stack.assign( _Node->_M_child.begin(), _Node->_M_child.end() );
+						while ( !stack.empty() ) {
+							link_const_type _Top = stack.back();
+							stack.pop_back();
+							if ( !_Top->_M_data.empty() ) return false;
+							if ( !_Top->isLeafNode() ) stack.insert( stack.end(), _Top->_M_child.begin(), _Top->_M_child.end() );
 						}
 						return true;	
 					}
 				}
 				//Traverse through OCTree structure by recursion calls of itself
 				//Inserts an object in a leaf OCTree node 
-				void _M_insert(link_type __N, object_const_reference __Object) {
+				//Returns the number of leaf nodes which received the object
+				//Recursion is kept on this hot path: it is as deep as the tree, which splits limit to maximal_height levels
+				//below the root (and growth to a few more), and an explicit stack would cost an allocation or a scratch lookup
+				size_type _M_insert(link_type __N, object_const_reference __Object) {
+					bool first = true;
+					return _M_insert(__N, __Object, first);
+				}
+				//first is true until a leaf node receives the object, the object is counted and summarized on the path to that node
+				size_type _M_insert(link_type __N, object_const_reference __Object, bool& first) {
+					const bool before = first;
+					size_type  count  = 0;
 					if (__Object( __N->_M_box ) ) {
 						if ( __N->isLeafNode() ) {
 							__N->Insert(__Object);
+							count = 1;
+							first = false;
 						} else
-							for ( auto it_node = __N->_M_child.begin(); it_node != __N->_M_child.end(); ++it_node ) _M_insert((*it_node), __Object);
+							for ( auto it_node = __N->_M_child.begin(); it_node != __N->_M_child.end(); ++it_node ) count += _M_insert((*it_node), __Object, first);
 					} 
+					__N->_M_count += count;
+					if ( before && !first ) {
+						__N->_M_objects++;
+						_M_aggregate(__N, __Object);
+					}
+					//Cached results of queries which overlap the branch are stale now
+					if ( count != 0 && _M_cache != nullptr ) 
+						++__N->_M_generation;
+					return count;
+				}
+				//Traverses through OCTree structure 
+				//Stores an object once in the deepest node whose enlarged box contains it
+				//Objects which fit none of child nodes stay in an internal node
+				void _M_insert_loose(link_type __N, object_const_reference __Object) {
+					if ( !__Object( __N->_M_box ) ) return;
+					link_type _Node = __N;
+					_Node->_M_count++;
+					_Node->_M_objects++;
+					_M_aggregate(_Node, __Object);
+					while ( !_Node->isLeafNode() ) {
+						link_type _Next = nullptr;
+						for ( auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end() && _Next == nullptr; ++it_node ) 
+							if ( __Object( _M_tighten( (*it_node)->_M_box ) ) && _M_is_inside( __Object, (*it_node)->_M_box ) ) 
+								_Next = (*it_node);
+						if ( _Next == nullptr ) break;
+						_Node = _Next;
+						_Node->_M_count++;
+						_Node->_M_objects++;
+						_M_aggregate(_Node, __Object);
+					}
+					_Node->Insert(__Object);
+					if ( _M_cache != nullptr ) {
+						for ( link_type _Branch = _Node; _Branch != __N; _Branch = _Branch->_M_parent ) 
+							++_Branch->_M_generation;
+						++__N->_M_generation;
+						//Objects of the root belong to no branch of it
+						if ( _Node->_M_parent == nullptr ) ++_M_generation;
+					}
 					return;
 				}
+				//Combines the summary of a node with an object
+				void _M_aggregate(link_type _Node, object_const_reference __Object) {
+					if ( std::is_same<aggregate_type, empty_aggregate>::value ) return;
+					_Node->Aggregate( aggregate_type::from_object(__Object) );
+				}
+				//Checks that an object is inside of a box using the overlap predicate of the object only
+				//The object must not overlap any of half-spaces which bound the box from outside
+				bool _M_is_inside(object_const_reference __Object, const box_type& box) const {
+					for ( size_t dim = 0; dim < __K; dim++ ) 
+						if ( __Object( _M_half_space(box, dim, true) ) || __Object( _M_half_space(box, dim, false) ) ) return false;
+					return true;
+				}
+				//Half-space which bounds a box from outside below (or above) it in a dimension
+				box_type _M_half_space(const box_type& box, size_t dim, bool below) const {
+					value_const_type _max = std::numeric_limits<value_type>::max();
+					box_type outside;
+					for ( size_t index = 0; index < __K; index++ ) {
+						outside._M_low_bounds [index] = -_max;
+						outside._M_high_bounds[index] =  _max;
+					}
+					if ( below ) outside._M_high_bounds[dim] = _M_next_value(box._M_low_bounds [dim], -_max);
+					else         outside._M_low_bounds [dim] = _M_next_value(box._M_high_bounds[dim],  _max);
+					return outside;
+				}
+				//Closest representable coordinate after a value towards a direction, the neighbour grid cell for integers
+				static value_type _M_next_value(value_const_type value, value_const_type direction) {
+					return _M_next_value(value, direction, std::is_integral<value_type>());
+				}
+				static value_type _M_next_value(value_const_type value, value_const_type direction, std::false_type) {
+					return std::nextafter(value, direction);
+				}
+				static value_type _M_next_value(value_const_type value, value_const_type direction, std::true_type) {
+					if ( value == direction ) return value;
+					return direction < value ? value - 1 : value + 1;
+				}
+				//Inserts an object starting from the root, as the ordinary or the loose OCTree does
+				void _M_insert_root(object_const_reference __Object) {
+					if ( _M_is_loose() ) 
+						return _M_insert_loose(_M_get_root(), __Object);
+					_M_insert(_M_get_root(), __Object);
+				}
+				//Waits until the root is not being replaced and registers an insert which a replacement has to wait for
+				void _M_enter_insert() {
+					std::atomic<size_type>& inserters = _M_inserters[_M_insert_slot()]._M_count;
+					while ( true ) {
+						while ( _M_exclusive ) std::this_thread::yield();
+						++inserters;
+						if ( !_M_exclusive ) return;
+						--inserters;
+					}
+				}
+				void _M_leave_insert() {
+					--_M_inserters[_M_insert_slot()]._M_count;
+				}
+				//Slot of the calling thread in _M_inserters, threads take slots in turn
+				static size_t _M_insert_slot() {
+					static std::atomic<size_t> next( 0 );
+					static thread_local size_t slot = next++ % _M_insert_slots;
+					return slot;
+				}
+				//Waits for running inserts and holds back new ones until _M_unlock_inserts
+				void _M_lock_inserts() {
+					_M_exclusive_mutex.lock();
+					_M_exclusive = true;
+					for ( auto it_slot = _M_inserters.begin(); it_slot != _M_inserters.end(); ++it_slot ) 
+						while ( it_slot->_M_count != 0 ) std::this_thread::yield();
+				}
+				void _M_unlock_inserts() {
+					_M_exclusive = false;
+					_M_exclusive_mutex.unlock();
+				}
+				//Returns whether the object is inside of the grown root, an object out of the range of coordinates is not
+				bool _M_grow(object_const_reference __Object) {
+					_M_lock_inserts();
+					_M_root = _M_grown( _M_get_root(), __Object );
+					_M_generation++;
+					const bool reached = _M_is_inside( __Object, _M_get_root()->_M_box );
+					_M_unlock_inserts();
+					return reached;
+				}
+				//Doubles a root box towards an object until the object is inside of it
+				//The old root becomes the child node on the opposite side, its siblings are new empty leaf nodes, which
+				//optimization splits once objects arrive
+				//Returns the new root
+				link_type _M_grown(link_type _Root, object_const_reference __Object) {
+					while ( !_M_is_inside( __Object, _Root->_M_box ) ) {
+						link_type              _Old = _Root;
+						const box_type          box = _M_tighten(_Old->_M_box);
+						box_type              grown = box;
+						std::array<int, __K>   side;
+						bool                 finite = true;
+						for ( size_t dim = 0; dim < __K; dim++ ) {
+							distance_const_type size = distance_type(box._M_high_bounds[dim]) - box._M_low_bounds[dim];
+							distance_type      bound;
+							if ( __Object( _M_half_space(box, dim, true) ) ) {
+								bound = box._M_low_bounds [dim] - size;
+								side[dim] =  1;
+							} else {
+								bound = box._M_high_bounds[dim] + size;
+								side[dim] = -1;
+							}
+							//Integer coordinates must not leave the range of value_type
+							finite &= std::isfinite(bound) && bound >= std::numeric_limits<value_type>::lowest() && bound <= std::numeric_limits<value_type>::max();
+							if ( !finite ) break;
+							if ( side[dim] == 1 ) grown._M_low_bounds [dim] = static_cast<value_type>(bound);
+							else                  grown._M_high_bounds[dim] = static_cast<value_type>(bound);
+						}
+						//The object cannot be reached, it is dropped by the insert as without the growth
+						if ( !finite ) break;
+
+						_Root           = new node_type();
+						_Root->_M_box   = _M_loosen(grown);
+						_Root->_M_child = _M_create_nodes(_Root);
+						for ( size_t index = 0; index < _Root->_M_child.size(); ++index ) 
+							if ( cartesian_product<__K>::product[index] == side ) {
+								delete _Root->_M_child[index];
+								_Root->_M_child[index] = _Old;
+							}
+						//The old root is read by queries meanwhile
+						_Old->setParent(_Root);
+						_Root->_M_count     = _Old->_M_count.load();
+						_Root->_M_objects   = _Old->_M_objects.load();
+						_Root->_M_aggregate = _Old->_M_aggregate;
+					}
+					return _Root;
+				}
+				//Copies OCTree structure by an explicit stack, states of the copy are reset for optimization
+				//Inserts may run meanwhile, so counters and summaries of the copy are rebuilt by the post-optimization
+				link_type _M_copy(link_const_type _Input) const {
+					std::vector< std::pair<link_const_type, link_type> > stack;
+					link_type _Root = new node_type();
+					stack.push_back( std::make_pair(_Input, _Root) );
+					while ( !stack.empty() ) {
+						const std::pair<link_const_type, link_type> top = stack.back();
+						stack.pop_back();
+						link_const_type _Source = top.first;
+						link_type       _Target = top.second;
+						_Target->_M_box       = _Source->_M_box;
+						_Target->_M_data      = _Source->_M_data;
+						_Target->_M_count     = _Source->_M_count.load();
+						_Target->_M_objects   = _Source->_M_objects.load();
+						if ( _Source->isLeafNode() ) continue;
+						for ( size_t index = 0; index < _Source->_M_child.size(); ++index ) {
+							_Target->_M_child[index] = new node_type();
+							_Target->_M_child[index]->_M_parent = _Target;
+							stack.push_back( std::make_pair(_Source->_M_child[index], _Target->_M_child[index]) );
+						}
+					}
+					return _Root;
+				}
+				//Inserts logged objects into the successor of the tree which are not in its copy yet; inserts are held back
+				//An insert logged while the tree was copied may have been copied too, so copies of an object are counted in 
+				//the first node which stores it in the current tree and topped up to that number in the successor
+				//In strict mode the copy may have taken an object in some of its leaf nodes only, so each leaf node which the
+				//object overlaps is topped up and summaries on the paths to them are rebuilt
+				//Returns whether anything was inserted
+				bool _M_replay(link_type& _Successor) {
+					std::sort( _M_log.begin(), _M_log.end() );
+					std::vector<link_type> touched, leaves;
+					bool inserted = false;
+					for ( auto it_data = _M_log.begin(); it_data != _M_log.end(); ) {
+						auto it_next = it_data;
+						while ( it_next != _M_log.end() && !(*it_data < *it_next) ) ++it_next;
+						const size_type current = _M_copies( _M_get_root(), *it_data );
+						if ( _M_auto_grow ) 
+							_Successor = _M_grown( _Successor, *it_data );
+						const size_type copied  = _M_copies( _Successor   , *it_data );
+						if ( _M_is_loose() ) {
+							for ( size_type index = copied; index < current; ++index, inserted = true ) 
+								_M_insert_loose(_Successor, *it_data);
+						} else if ( copied == 0 ) {
+							//Objects which were not copied at all are inserted as usual
+							for ( size_type index = copied; index < current; ++index, inserted = true ) 
+								_M_insert(_Successor, *it_data);
+						} else if ( _M_top_up(_Successor, *it_data, current, leaves) ) {
+							touched.insert( touched.end(), leaves.begin(), leaves.end() );
+							inserted = true;
+						}
+						it_data = it_next;
+					}
+					//Deeper nodes first, so child nodes are summarized before their parents
+					std::vector< std::pair<size_type, link_type> > nodes;
+					for ( auto it_node = touched.begin(); it_node != touched.end(); ++it_node ) {
+						size_type depth = 0;
+						for ( link_type _Node = (*it_node)->_M_parent; _Node != nullptr; _Node = _Node->_M_parent ) depth++;
+						for ( link_type _Node = *it_node; _Node != nullptr; _Node = _Node->_M_parent ) nodes.push_back( std::make_pair(depth--, _Node) );
+					}
+					std::sort( nodes.begin(), nodes.end(), [] (const std::pair<size_type, link_type>& a, const std::pair<size_type, link_type>& b) { 
+						return a.first != b.first ? a.first > b.first : a.second < b.second; 
+					} );
+					nodes.erase( std::unique( nodes.begin(), nodes.end() ), nodes.end() );
+					for ( auto it_node = nodes.begin(); it_node != nodes.end(); ++it_node ) 
+						_M_summarize(it_node->second);
+					return inserted;
+				}
+				//Adds copies of an object to the leaf nodes of a branch which it overlaps until each of them has the given
+				//number of copies, counters and summaries are not changed; leaves gets all of these leaf nodes
+				//Returns whether any copy was added
+				bool _M_top_up(link_type _Input, object_const_reference __Object, size_type copies, std::vector<link_type>& leaves) {
+					leaves.clear();
+					std::vector<link_type> stack( 1, _Input );
+					bool added = false;
+					while ( !stack.empty() ) {
+						link_type _Node = stack.back();
+						stack.pop_back();
+						if ( !__Object( _Node->_M_box ) ) continue;
+						if ( !_Node->isLeafNode() ) {
+							stack.insert( stack.end(), _Node->_M_child.begin(), _Node->_M_child.end() );
+							continue;
+						}
+						leaves.push_back(_Node);
+						size_type count = 0;
+						for (auto it_data = _Node->_M_data.begin(); it_data != _Node->_M_data.end(); ++it_data)
+							if ( !(*it_data < __Object) && !(__Object < *it_data) ) ++count;
+						for ( ; count < copies; ++count, added = true ) 
+							_Node->Insert(__Object);
+					}
+					return added;
+				}
+				//Runs the optimization phases on a tree which is not published yet
+				//Branches of the root are optimized by separate threads
+				void _M_optimize_parallel(link_type _Root) {
+					_M_pre_optimize(_Root);
+					//The memory budget is shared by the whole tree, so it is optimized by one thread
+					if ( _M_memory_budget != 0 ) {
+						_M_optimize_budget(_Root);
+						_M_post_optimize  (_Root);
+						return;
+					}
+					if ( _Root->isLeafNode() || _Root->_M_state != node_type::STATE::M_DEFAULT ) {
+						_M_optimize     (_Root);
+						_M_post_optimize(_Root);
+						return;
+					}
+					//Summaries look into the other branches for copies of objects, so they are rebuilt once all branches are sorted
+					std::vector< std::future<void> > futures;
+					for (auto it_node = _Root->_M_child.begin(); it_node != _Root->_M_child.end(); ++it_node ) {
+						link_type _Node = *it_node;
+						futures.push_back( std::async( std::launch::async, [this, _Node] () {
+							_M_optimize (_Node);
+							_M_sort_data(_Node);
+						} ) );
+					}
+					for ( auto it_future = futures.begin(); it_future != futures.end(); ++it_future ) 
+						it_future->get();
+					futures.clear();
+					for (auto it_node = _Root->_M_child.begin(); it_node != _Root->_M_child.end(); ++it_node ) {
+						link_type _Node = *it_node;
+						futures.push_back( std::async( std::launch::async, [this, _Node] () { _M_summarize_branch(_Node); } ) );
+					}
+					for ( auto it_future = futures.begin(); it_future != futures.end(); ++it_future ) 
+						it_future->get();
+					//The root stores objects in loose mode
+					if ( !_Root->_M_data.empty() ) 
+						_Root->sortData();
+					_M_summarize(_Root);
+				}
+				//Checks that an object stored in a node does not have to be moved by relocate_all
+				//An object which touches the bounds of a leaf node can overlap its neighbours, so it is moved in strict mode
+				bool _M_stays(link_const_type _Node, object_const_reference __Object) const {
+					if ( !_M_is_loose() ) return _M_is_inside( __Object, _M_interior(_Node->_M_box) );
+					if ( !_M_contains(_Node, __Object) ) return false;
+					//An object which fits a child node now is moved down
+					for ( auto it_node = _Node->_M_child.begin(); it_node != _Node->_M_child.end(); ++it_node ) 
+						if ( *it_node != nullptr && _M_contains(*it_node, __Object) ) return false;
+					return true;
+				}
+				//Box without its bounds, objects inside of it do not overlap neighbours of the box
+				box_type _M_interior(const box_type& box) const {
+					box_type inner = box;
+					for ( size_t dim = 0; dim < __K; dim++ ) {
+						inner._M_low_bounds [dim] = _M_next_value(box._M_low_bounds [dim], box._M_high_bounds[dim]);
+						inner._M_high_bounds[dim] = _M_next_value(box._M_high_bounds[dim], box._M_low_bounds [dim]);
+					}
+					return inner;
+				}
+				//Checks that an insert starting from a node stores the object in all leaf nodes which it overlaps, as an insert 
+				//from the root does: in strict mode an object which touches the bounds of a node below the root is stored 
+				//by neighbours of the node as well, so it has to be inside of the interior of the node
+				bool _M_encloses(link_const_type _Node, object_const_reference __Object) const {
+					if ( _M_is_loose() || _Node->_M_parent == nullptr ) return _M_contains(_Node, __Object);
+					return _M_is_inside( __Object, _M_interior(_Node->_M_box) );
+				}
+				//Checks that an insert starting from a node stores all of an object below the node
+				bool _M_contains(link_const_type _Node, object_const_reference __Object) const {
+					if ( !_M_is_inside(__Object, _Node->_M_box) ) return false;
+					return !_M_is_loose() || _Node->_M_parent == nullptr || __Object( _M_tighten(_Node->_M_box) );
+				}
+				//Runs task(index, worker) for indices [0, count) on threads which take the next index one by one
+				template <class _Task>
+					void _M_parallel_for(size_type count, size_t threads, const _Task& task) const {
+						threads = std::min<size_t>( threads, count );
+						if ( threads <= 1 ) {
+							for ( size_type index = 0; index < count; ++index ) task(index, 0);
+							return;
+						}
+						std::atomic<size_type>   next( 0 );
+						std::vector<std::thread> workers;
+						for ( size_t worker = 0; worker < threads; ++worker ) 
+							workers.push_back( std::thread( [&task, &next, count, worker] () {
+								for ( size_type index = next++; index < count; index = next++ ) 
+									task(index, worker);
+							} ) );
+						for ( auto it_worker = workers.begin(); it_worker != workers.end(); ++it_worker ) 
+							it_worker->join();
+					}
+				//Registers a running query in the counter of its epoch, the tree it reads is not deleted by optimize_async
+				//until the query ends; a query which sees the epoch change while it registers takes the counter of the new one
+				class _M_reader_guard {
+					public:
+						_M_reader_guard(const OCTree& tree) : _M_tree(tree), _M_slot(0) { 
+							while ( true ) {
+								const size_type epoch = _M_tree._M_epoch;
+								_M_slot = epoch % 2;
+								++_M_tree._M_readers[_M_slot];
+								if ( _M_tree._M_epoch == epoch ) return;
+								--_M_tree._M_readers[_M_slot];
+							}
+						}
+						~_M_reader_guard() { --_M_tree._M_readers[_M_slot]; }
+					private:
+						_M_reader_guard  (const _M_reader_guard&);
+						_M_reader_guard& operator=(const _M_reader_guard&);
+						const OCTree& _M_tree;
+						size_t        _M_slot;
+				};
+				bool     _M_is_loose() const { return _M_loose_factor > 1; }
+				//Enlarges a box around its center by the loose factor
+				box_type _M_loosen (const box_type& box) const {
+					if ( !_M_is_loose() ) return box;
+					box_type result;
+					for ( size_t dim = 0; dim < __K; dim++ ) {
+						distance_const_type center = (distance_type(box._M_low_bounds[dim]) + box._M_high_bounds[dim])/2;
+						distance_const_type half   = (distance_type(box._M_high_bounds[dim]) - box._M_low_bounds[dim])/2*_M_loose_factor;
+						result._M_low_bounds [dim] = _M_clamp(center - half);
+						result._M_high_bounds[dim] = _M_clamp(center + half);
+					}
+					return result;
+				}
+				//Converts a bound to value_type, enlarged boxes of integer coordinates are cut at the range of value_type
+				static value_type _M_clamp(distance_const_type value) {
+					return static_cast<value_type>( std::min<distance_type>( std::max<distance_type>( value, std::numeric_limits<value_type>::lowest() ), std::numeric_limits<value_type>::max() ) );
+				}
+				//Shrinks an enlarged box back to the cell of the node
+				box_type _M_tighten(const box_type& box) const {
+					if ( !_M_is_loose() ) return box;
+					box_type result;
+					for ( size_t dim = 0; dim < __K; dim++ ) {
+						distance_const_type center = (distance_type(box._M_low_bounds[dim]) + box._M_high_bounds[dim])/2;
+						distance_const_type half   = (distance_type(box._M_high_bounds[dim]) - box._M_low_bounds[dim])/2/_M_loose_factor;
+						result._M_low_bounds [dim] = _M_clamp(center - half);
+						result._M_high_bounds[dim] = _M_clamp(center + half);
+					}
+					return result;
+				}
 				//Builds OCTree structure	  
 				void _M_build_tree(const box_type& box, size_t height){
-					_M_root = new _Node< __K, __Val, __Sync>();
-					_M_root->_M_box = box;
-					if ( height > 0 ) _M_root->_M_child = _M_create_nodes(_M_root, height);
+					link_type _Root = new node_type();
+					_Root->_M_box = _M_loosen(box);
+					if ( height > 0 ) _Root->_M_child = _M_create_nodes(_Root, height);
+					_M_root = _Root;
 					return;
 				}
 				//Create additional nodes
@@ -611,19 +2511,20 @@ template <typename type> struct max {
 					typename cartesian_product<__K>::const_iterator begin = cartesian_product<__K>::product.begin();
 					typename cartesian_product<__K>::const_iterator end   = cartesian_product<__K>::product.end();
 					size_t index;
-					const box_type& box = parent->_M_box; 
+					const box_type  box = _M_tighten(parent->_M_box); 
 					//Iteration over an nodes of the parent node
 					for ( index = 0, it = begin; it != end; ++it, ++index ) {
 						box_type _box;
 						for ( size_t dim = 0; dim < __K; dim++ ) {
-							_box._M_low_bounds[dim]  = std::min( ((1 - (*it)[dim])*box._M_low_bounds[dim] + (1 +(*it)[dim])*box._M_high_bounds[dim])/2,
-																	(box._M_low_bounds[dim] + box._M_high_bounds[dim])/2 );
-							_box._M_high_bounds[dim] = std::max( ((1 - (*it)[dim])*box._M_low_bounds[dim] + (1 +(*it)[dim])*box._M_high_bounds[dim])/2, 
-																	(box._M_low_bounds[dim] + box._M_high_bounds[dim])/2 );
+							//Bounds are computed in distance_type, so sums of integer coordinates do not overflow
+							distance_const_type low  = box._M_low_bounds [dim];
+							distance_const_type high = box._M_high_bounds[dim];
+							_box._M_low_bounds[dim]  = static_cast<value_type>( std::min( ((1 - (*it)[dim])*low + (1 +(*it)[dim])*high)/2, (low + high)/2 ) );
+							_box._M_high_bounds[dim] = static_cast<value_type>( std::max( ((1 - (*it)[dim])*low + (1 +(*it)[dim])*high)/2, (low + high)/2 ) );
 						}
-						result[index] = new _Node< __K, __Val,  __Sync>();
+						result[index] = new node_type();
 						result[index]->_M_parent = parent;
-						result[index]->_M_box = _box;
+						result[index]->_M_box = _M_loosen(_box);
 					}
 					if ( --height > 0 ) {
 						typename std::array<link_type, power<__K>::result>::iterator it;
@@ -637,14 +2538,50 @@ template <typename type> struct max {
 				//Removes a node
 				std::vector<__Val> _M_remove_node(link_type _M_node) {
 					std::vector<__Val> result;
-					if(_M_node != nullptr) result = _M_node->_M_data;
+					if(_M_node != nullptr) result.assign( _M_node->_M_data.begin(), _M_node->_M_data.end() );
 					delete _M_node;
 					return result;
 				}
-				link_type   _M_root;
+				std::atomic<link_type> _M_root;
+				//Bumped whenever nodes can be removed from OCTree structure
+				std::atomic<size_type> _M_revision;
+				//Enlargement of node boxes, 1 for the ordinary OCTree
+				const distance_type    _M_loose_factor;
+				//Threads which expand wide frontiers of queries
+				std::unique_ptr<thread_pool> _M_pool;
+				size_type                    _M_chunk_size;
+				//Growth of the root towards objects outside of it
+				std::atomic<bool>            _M_auto_grow;
+				//Inserts are drained and held back while the root is replaced
+				//Running inserts are counted in slots of their threads, which are padded to separate cache lines, 
+				//so inserts of different threads do not write the same counter
+				struct _M_inserters_type {
+					_M_inserters_type() : _M_count(0) {}
+					std::atomic<size_type> _M_count;
+					char                   _M_padding[64 - sizeof(std::atomic<size_type>)];
+				};
+				static const size_t                                  _M_insert_slots = 16;
+				std::atomic<bool>                                    _M_exclusive;
+				std::array<_M_inserters_type, _M_insert_slots>       _M_inserters;
+				std::mutex                                           _M_exclusive_mutex;
+				//Objects inserted while optimize_async builds a new tree
+				std::mutex                   _M_async_mutex;
+				std::atomic<bool>            _M_logging;
+				std::mutex                   _M_log_mutex;
+				std::vector<object_type>     _M_log;
+				//Running queries by the parity of the epoch in which they started, optimize_async starts the next epoch
+				//after it replaces the root and waits for queries of the previous one before it deletes the old tree
+				mutable std::atomic<size_type>  _M_epoch;
+				mutable std::atomic<size_type>  _M_readers[2];
+				//Bytes which optimization may use for nodes and objects, 0 is no limit
+				std::atomic<size_type>          _M_memory_budget;
+				//Bumped whenever cached query results of all regions become stale
+				std::atomic<size_type>          _M_generation;
+				std::unique_ptr<_M_cache_type>  _M_cache;
+				distance_type                   _M_cache_quantum;
 #ifdef OCTTREE_DEFINE_OSTREAM_OPERATORS
-				friend std::ostream& operator<<(std::ostream& o, OCTree<__K, __Val, __Sync> const& tree) {
-					typedef OCTree<__K, __Val, __Sync> _Tree;
+				friend std::ostream& operator<<(std::ostream& o, OCTree<__K, __Val, __Sync, __Aggregate> const& tree) {
+					typedef OCTree<__K, __Val, __Sync, __Aggregate> _Tree;
 						if (tree.empty()) return o << "[empty " << "OCTree " << &tree << "]";
 						o << "dimensions                  : " << __K                                                  << std::endl;
 						o << "minimum height              : " << tree.min_height()                                    << std::endl;
@@ -670,7 +2607,8 @@ template <typename type> struct max {
 			public:
 				template<class __Functor = _TrueFunctor>
 				bool dump(const std::string& filename, const __Functor& functor = _TrueFunctor() ) const {
-						typedef OCTree<__K, __Val, __Sync> _Tree;
+					_M_reader_guard reader(*this);
+						typedef OCTree<__K, __Val, __Sync, __Aggregate> _Tree;
 						typedef _Tree::link_const_type   link_const_type;
 						typedef _Tree::box_const_type box_const_type;
 
@@ -0,0 +1,258 @@
+#ifndef INCLUDE_OCTTREE_SHARDED_HPP
+#define INCLUDE_OCTTREE_SHARDED_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "octree.hpp"
+
+namespace OCTree {
+	//Front end which splits the root box into a grid of cells, each cell is an OCTree (shard) owned by one worker thread
+	//Producers route objects to the workers which own overlapping cells through lock-free queues,
+	//so shards are changed by their owners only and the default synchronization policy does no locking
+	//Shards are built and grown by their workers, so node memory is first touched on the owning thread (NUMA-local
+	//if workers are pinned to cores); queries visit only shards whose roots pass the query
+	template < size_t const __K, typename __Val, class __Sync = empty_sync_object, class __Aggregate = empty_aggregate >
+		class ShardedOCTree {
+			public:
+				typedef OCTree<__K, __Val, __Sync, __Aggregate>   shard_type;
+				typedef typename shard_type::object_type          object_type;
+				typedef typename shard_type::object_const_reference object_const_reference;
+				typedef typename shard_type::value_type           value_type;
+				typedef typename shard_type::value_const_type     value_const_type;
+				typedef typename shard_type::distance_type        distance_type;
+				typedef typename shard_type::distance_const_type  distance_const_type;
+				typedef typename shard_type::size_type            size_type;
+				typedef typename shard_type::box_type             box_type;
+				typedef typename shard_type::box_const_type       box_const_type;
+				typedef typename shard_type::query_type           query_type;
+				typedef typename shard_type::query_const_type     query_const_type;
+			private:
+				ShardedOCTree  (const ShardedOCTree&);
+				ShardedOCTree& operator=(const ShardedOCTree&);
+				//Object routed to a cell of a worker
+				typedef std::pair<size_type, object_type> _M_item_type;
+				struct _M_worker_type {
+					_M_worker_type() : _M_queue(), _M_pushed(0), _M_processed(0), _M_task(nullptr), _M_thread() {}
+					mpsc_queue<_M_item_type>              _M_queue;
+					std::atomic<size_type>                _M_pushed;
+					std::atomic<size_type>                _M_processed;
+					//Control task (optimize) run by the worker between objects
+					std::atomic<std::function<void()>*>   _M_task;
+					std::thread                           _M_thread;
+				};
+			public:
+				//workers is the number of worker threads, the grid has at least as many cells as workers
+				//height is the height of the whole structure, shards get the part below the grid
+				ShardedOCTree( const box_type& box, size_t workers = std::thread::hardware_concurrency(), const size_t height = 4 )
+					: _M_boxes(), _M_shards(), _M_workers(), _M_ready(0), _M_stop(false)
+				{
+					workers = std::max<size_t>( 1, workers );
+					size_type level = 1;
+					while ( _M_cells(level) < workers ) ++level;
+					_M_build_grid(box, level);
+					_M_shards.resize( _M_boxes.size(), nullptr );
+					const size_t shard_height = height > level ? height - level : 0;
+					for ( size_t index = 0; index < workers; ++index )
+						_M_workers.push_back( std::unique_ptr<_M_worker_type>( new _M_worker_type() ) );
+					for ( size_t index = 0; index < workers; ++index )
+						_M_workers[index]->_M_thread = std::thread( &ShardedOCTree::_M_run, this, index, shard_height );
+					while ( _M_ready != workers ) std::this_thread::yield();
+				}
+				~ShardedOCTree() {
+					_M_stop = true;
+					for ( auto it_worker = _M_workers.begin(); it_worker != _M_workers.end(); ++it_worker )
+						(*it_worker)->_M_thread.join();
+				}
+				//Routes an object to the owners of all cells which it overlaps, can be called by any number of threads
+				void insert(object_const_reference __Object) {
+					for ( size_type cell = 0; cell < _M_boxes.size(); ++cell ) {
+						if ( !__Object(_M_boxes[cell]) ) continue;
+						_M_worker_type& worker = *_M_workers[ cell % _M_workers.size() ];
+						worker._M_pushed++;
+						worker._M_queue.push( _M_item_type(cell, __Object) );
+					}
+				}
+				//Waits until workers have inserted all routed objects
+				//Queries see objects inserted before the last flush; with the default empty_sync_object
+				//they must not run concurrently with inserts
+				void flush() const {
+					for ( auto it_worker = _M_workers.begin(); it_worker != _M_workers.end(); ++it_worker )
+						while ( (*it_worker)->_M_processed != (*it_worker)->_M_pushed ) std::this_thread::yield();
+				}
+				//Optimizes every shard on the thread which owns it
+				void optimize() {
+					flush();
+					_M_run_on_workers( [] (shard_type& shard) { shard.optimize(); } );
+				}
+				size_type shards () const { return _M_shards.size();  }
+				size_type workers() const { return _M_workers.size(); }
+
+				//Same as OCTree::find_if, shards whose roots fail the functor are skipped
+				//Objects which overlap several cells are found in each of them, so results are sorted and made unique,
+				//as in find_within; an object inserted several times is returned once
+				template <class _Functor>
+					std::vector<object_type> find_if (const _Functor& _functor) const {
+						std::vector<object_type> output, part;
+						for ( auto it_shard = _M_shards.begin(); it_shard != _M_shards.end(); ++it_shard ) {
+							if ( !_functor( *(*it_shard)->_M_get_root() ) ) continue;
+							(*it_shard)->find_if(_functor, part);
+							output.insert( output.end(), part.begin(), part.end() );
+						}
+						std::sort( output.begin(), output.end() );
+						output.erase( std::unique( output.begin(), output.end(), [] (object_const_reference a, object_const_reference b) {
+							return !(a < b) && !(b < a);
+						} ), output.end() );
+						return output;
+					}
+				//Same as OCTree::count_in, an object is counted by the first shard whose cell it overlaps, like the first copy
+				//of an object in a tree; nodes inside of the region are walked object by object in shards which share objects
+				//Without the exact predicate objects of boundary nodes are counted as a whole, so the count depends on the
+				//nodes of the shards and is not the count of a single OCTree; with it both counts are the same
+				template <class _Region>
+					size_type count_in (const _Region& region) const {
+						return _M_count_in(region, static_cast<const _TrueFunctor*>(nullptr));
+					}
+				//Objects of boundary nodes are counted if the exact predicate is true for them
+				template <class _Region, class _Exact>
+					size_type count_in (const _Region& region, const _Exact& exact) const {
+						return _M_count_in(region, &exact);
+					}
+				//Same as OCTree::find_within, shards farther than radius are skipped
+				template <class _Distance>
+					std::vector< std::pair<object_type, distance_type> > find_within(query_const_type& point, distance_const_type radius, const _Distance& distance, bool sorted = true) const {
+						typedef std::pair<object_type, distance_type> result_type;
+						std::vector<result_type> output, part;
+						for ( auto it_shard = _M_shards.begin(); it_shard != _M_shards.end(); ++it_shard ) {
+							if ( (*it_shard)->_M_get_root()->_M_box.shortest_distance(point) > radius*radius ) continue;
+							(*it_shard)->find_within(point, radius, distance, part, false);
+							output.insert( output.end(), part.begin(), part.end() );
+						}
+						//Objects which overlap several cells are found in each of them
+						std::sort( output.begin(), output.end(), [sorted] (const result_type& a, const result_type& b) {
+							if ( sorted && ( a.second < b.second || b.second < a.second ) ) return a.second < b.second;
+							return a.first < b.first;
+						} );
+						output.erase( std::unique( output.begin(), output.end(), [] (const result_type& a, const result_type& b) {
+							return !(a.first < b.first) && !(b.first < a.first);
+						} ), output.end() );
+						return output;
+					}
+				//Same as OCTree::find_nearest_object, shards are visited by the distance to their boxes
+				template <class _Distance>
+					std::vector< std::pair<object_type, distance_type> > find_nearest_object(query_const_type& point, const _Distance& distance, distance_const_type epsilon = 0) const {
+						std::vector< std::pair<distance_type, size_type> > order;
+						for ( size_type cell = 0; cell < _M_shards.size(); ++cell )
+							order.push_back( std::make_pair( _M_shards[cell]->_M_get_root()->_M_box.shortest_distance(point), cell ) );
+						std::sort( order.begin(), order.end() );
+
+						distance_const_type scale = 1/((1 + epsilon)*(1 + epsilon));
+						std::vector< std::pair<object_type, distance_type> > output;
+						for ( auto it_order = order.begin(); it_order != order.end(); ++it_order ) {
+							if ( !output.empty() && it_order->first > scale*output[0].second ) break;
+							std::vector< std::pair<object_type, distance_type> > part = _M_shards[it_order->second]->find_nearest_object(point, distance, epsilon);
+							if ( part.empty() ) continue;
+							if ( output.empty() || part[0].second < output[0].second || ( !(output[0].second < part[0].second) && part[0].first < output[0].first ) )
+								output = part;
+						}
+						return output;
+					}
+			private:
+				template <class _Region, class _Exact>
+					size_type _M_count_in (const _Region& region, _Exact exact) const {
+						size_type count = 0;
+						for ( size_type cell = 0; cell < _M_shards.size(); ++cell ) {
+							const shard_type& shard = *_M_shards[cell];
+							typename shard_type::_M_reader_guard reader(shard);
+							if ( !region.intersects_with( shard._M_get_root()->_M_box ) ) continue;
+							//Objects of the first cell are not shared with an earlier one
+							if ( cell == 0 ) {
+								count += shard._M_count_in(shard._M_get_root(), region, exact, static_cast<const _TrueFunctor*>(nullptr));
+								continue;
+							}
+							const auto first = [this, cell] (object_const_reference __Object) { return _M_first_cell(__Object) == cell; };
+							count += shard._M_count_in(shard._M_get_root(), region, exact, &first);
+						}
+						return count;
+					}
+				//First cell which an object overlaps, insert routes the object to it and to the later ones which it overlaps
+				size_type _M_first_cell(object_const_reference __Object) const {
+					size_type cell = 0;
+					while ( cell < _M_boxes.size() && !__Object(_M_boxes[cell]) ) ++cell;
+					return cell;
+				}
+				static size_type _M_cells(size_type level) {
+					size_type cells = 1;
+					for ( size_type index = 0; index < level*__K; ++index ) cells *= 2;
+					return cells;
+				}
+				//Splits a box into 2^level parts in each dimension
+				void _M_build_grid(const box_type& box, size_type level) {
+					const size_type side = size_type(1) << level;
+					for ( size_type cell = 0; cell < _M_cells(level); ++cell ) {
+						box_type _box;
+						size_type rest = cell;
+						for ( size_t dim = 0; dim < __K; dim++, rest /= side ) {
+							value_const_type step = (box._M_high_bounds[dim] - box._M_low_bounds[dim])/side;
+							_box._M_low_bounds [dim] = box._M_low_bounds[dim] + step*(rest % side);
+							_box._M_high_bounds[dim] = (rest % side) + 1 == side ? box._M_high_bounds[dim] : box._M_low_bounds[dim] + step*(rest % side + 1);
+						}
+						_M_boxes.push_back(_box);
+					}
+				}
+				//Runs a task for each shard on the thread which owns it and waits for all workers
+				void _M_run_on_workers(const std::function<void(shard_type&)>& task) {
+					std::vector< std::function<void()> > tasks;
+					for ( size_type index = 0; index < _M_workers.size(); ++index )
+						tasks.push_back( [this, index, &task] () {
+							for ( size_type cell = index; cell < _M_shards.size(); cell += _M_workers.size() )
+								task( *_M_shards[cell] );
+						} );
+					for ( size_type index = 0; index < _M_workers.size(); ++index )
+						_M_workers[index]->_M_task = &tasks[index];
+					for ( auto it_worker = _M_workers.begin(); it_worker != _M_workers.end(); ++it_worker )
+						while ( (*it_worker)->_M_task.load() != nullptr ) std::this_thread::yield();
+				}
+				//Worker loop: builds the shards of the worker, then inserts routed objects and runs control tasks
+				void _M_run(size_type index, size_t shard_height) {
+					_M_worker_type& worker = *_M_workers[index];
+					for ( size_type cell = index; cell < _M_shards.size(); cell += _M_workers.size() )
+						_M_shards[cell] = new shard_type(_M_boxes[cell], shard_height);
+					++_M_ready;
+
+					_M_item_type item;
+					size_type    idle = 0;
+					while ( true ) {
+						bool busy = false;
+						while ( worker._M_queue.pop(item) ) {
+							_M_shards[item.first]->insert(item.second);
+							worker._M_processed++;
+							busy = true;
+						}
+						std::function<void()>* task = worker._M_task.load();
+						if ( task != nullptr ) {
+							(*task)();
+							worker._M_task = nullptr;
+							busy = true;
+						}
+						if ( busy ) { idle = 0; continue; }
+						if ( _M_stop && worker._M_processed == worker._M_pushed ) break;
+						//Back off when there is nothing to do for a while
+						if ( ++idle < 64 ) std::this_thread::yield();
+						else               std::this_thread::sleep_for( std::chrono::microseconds(100) );
+					}
+					for ( size_type cell = index; cell < _M_shards.size(); cell += _M_workers.size() )
+						delete _M_shards[cell];
+				}
+				std::vector<box_type>                          _M_boxes;
+				std::vector<shard_type*>                       _M_shards;
+				std::vector< std::unique_ptr<_M_worker_type> > _M_workers;
+				std::atomic<size_type>                         _M_ready;
+				std::atomic<bool>                              _M_stop;
+		};
+}
+#endif //INCLUDE_OCTTREE_SHARDED_HPP
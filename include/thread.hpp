@@ -14,6 +14,12 @@
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <vector>
 
 namespace OCTree {
 	typedef std::recursive_mutex recursive_mutex_sync_object;
@@ -38,6 +44,107 @@ namespace OCTree {
 		void lock()     { return;      }
 		void unlock()   { return;      }
 	};
+
+	//Shared/exclusive lock: readers take lock_shared() and run concurrently, writers take lock()
+	//A writer which waits for readers stops new readers from entering
+	//Both sides wait by spinning with yield, like spin_lock_sync_object, so it suits short read sections only;
+	//C++11 has no shared mutex which blocks waiting threads
+	class shared_mutex_sync_object {
+		std::atomic<bool>                 writer;
+		std::atomic<size_t>               readers;
+	public:
+		shared_mutex_sync_object() : writer(false), readers(0) {}
+		void lock() {
+			while( writer.exchange(true) )
+				std::this_thread::yield();
+			while( readers.load() != 0 )
+				std::this_thread::yield();
+		}
+		void unlock() {
+			writer.store(false);
+		}
+		void lock_shared() {
+			for (;;) {
+				while( writer.load() )
+					std::this_thread::yield();
+				readers++;
+				if ( !writer.load() ) return;
+				readers--;
+			}
+		}
+		void unlock_shared() {
+			readers--;
+		}
+	};
+
+	//Sequence lock: a writer keeps the sequence odd while it changes data, readers take no lock,
+	//they read the sequence before and after reading data and retry if it has changed
+	//Readers copy data by plain loads which may overlap a writer; such a copy is discarded, so it only suits
+	//trivially copyable data, and race detectors report the overlapping loads
+	class seqlock_sync_object {
+		std::atomic<size_t>               sequence;
+	public:
+		seqlock_sync_object() : sequence(0) {}
+		void lock() {
+			size_t current = sequence.load(std::memory_order_relaxed);
+			while( (current & 1) != 0 || !sequence.compare_exchange_weak(current, current + 1, std::memory_order_acquire) ) {
+				std::this_thread::yield();
+				current = sequence.load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+		void unlock() {
+			sequence.fetch_add(1, std::memory_order_release);
+		}
+		size_t read_begin() const {
+			size_t current;
+			while( ((current = sequence.load(std::memory_order_acquire)) & 1) != 0 )
+				std::this_thread::yield();
+			return current;
+		}
+		bool read_retry(size_t begin) const {
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return sequence.load(std::memory_order_relaxed) != begin;
+		}
+	};
+
+	//Read paths of nodes run readers through sync_traits<Sync>::read(sync, reader)
+	//Exclusive policies lock the sync object, a reader must only read and return a copy of what it reads
+	template< class __Sync >
+	struct sync_traits {
+		template <class __Reader>
+		static auto read(__Sync& sync, const __Reader& reader) -> decltype(reader()) {
+			std::unique_lock<__Sync> lock(sync);
+			return reader();
+		}
+	};
+	//Readers share the lock
+	template<>
+	struct sync_traits<shared_mutex_sync_object> {
+		struct shared_lock {
+			shared_mutex_sync_object&     sync;
+			shared_lock(shared_mutex_sync_object& sync_) : sync(sync_) { sync.lock_shared(); }
+			~shared_lock() { sync.unlock_shared(); }
+		};
+		template <class __Reader>
+		static auto read(shared_mutex_sync_object& sync, const __Reader& reader) -> decltype(reader()) {
+			shared_lock lock(sync);
+			return reader();
+		}
+	};
+	//Readers do not lock, a read which overlaps a writer is repeated
+	template<>
+	struct sync_traits<seqlock_sync_object> {
+		template <class __Reader>
+		static auto read(seqlock_sync_object& sync, const __Reader& reader) -> decltype(reader()) {
+			static_assert( std::is_trivially_copyable<decltype(reader())>::value, "seqlock readers copy trivially copyable data only" );
+			for (;;) {
+				const size_t begin = sync.read_begin();
+				auto result = reader();
+				if ( !sync.read_retry(begin) ) return result;
+			}
+		}
+	};
 	
 	template< class __Sync >
 	class barrier {
@@ -79,6 +186,93 @@ namespace OCTree {
 			sync.unlock();
 		}
 	};
+	class thread_pool {
+	private:
+		std::vector<std::thread>                  workers;
+		std::deque< std::function<void()> >         tasks;
+		std::mutex                                   sync;
+		std::condition_variable                        cv;
+		bool                                         stop;
+	private:
+		thread_pool(const thread_pool&);
+	public:
+		thread_pool(size_t thread_num) : workers(), tasks(), sync(), cv(), stop(false) {
+			for (size_t i = 0; i < thread_num; ++i)
+				workers.push_back(std::thread(&thread_pool::run, this));
+		}
+		~thread_pool() {
+			{
+				std::unique_lock<std::mutex> lock(sync);
+				stop = true;
+			}
+			cv.notify_all();
+			for (auto it = workers.begin(); it != workers.end(); ++it)
+				it->join();
+		}
+		size_t size() const { return workers.size(); }
+		template <class __Task>
+		std::future<void> submit(__Task task) {
+			std::shared_ptr< std::packaged_task<void()> > packaged = std::make_shared< std::packaged_task<void()> >(task);
+			std::future<void> result = packaged->get_future();
+			{
+				std::unique_lock<std::mutex> lock(sync);
+				tasks.push_back([packaged]() { (*packaged)(); });
+			}
+			cv.notify_one();
+			return result;
+		}
+	private:
+		void run() {
+			for (;;) {
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(sync);
+					while (!stop && tasks.empty())
+						cv.wait(lock);
+					if (tasks.empty()) return;
+					task = std::move(tasks.front());
+					tasks.pop_front();
+				}
+				task();
+			}
+		}
+	};
+	//Unbounded lock-free queue for many producers and a single consumer
+	//push is wait-free, pop is called by the consumer thread only
+	template <class __Item>
+	class mpsc_queue {
+	private:
+		struct node {
+			node() : next(nullptr), item() {}
+			node(const __Item& value) : next(nullptr), item(value) {}
+			std::atomic<node*>                   next;
+			__Item                               item;
+		};
+		std::atomic<node*>                       head;
+		node*                                    tail;
+	private:
+		mpsc_queue(const mpsc_queue&);
+	public:
+		mpsc_queue() : head(new node()), tail(nullptr) { tail = head.load(); }
+		~mpsc_queue() {
+			__Item item;
+			while (pop(item)) {}
+			delete tail;
+		}
+		void push(const __Item& item) {
+			node* next = new node(item);
+			node* prev = head.exchange(next, std::memory_order_acq_rel);
+			prev->next.store(next, std::memory_order_release);
+		}
+		bool pop(__Item& item) {
+			node* next = tail->next.load(std::memory_order_acquire);
+			if (next == nullptr) return false;
+			item = next->item;
+			delete tail;
+			tail = next;
+			return true;
+		}
+	};
 }
 #endif //INCLUDE_OCTTREE_THREAD_HPP
 